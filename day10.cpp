@@ -1,4 +1,7 @@
 #include "util.h"
+#include <queue>
+#include <random>
+#include <thread>
 
 bool is_open(char x) {
     switch (x) {
@@ -106,36 +109,253 @@ std::optional<std::string> make_closing_string(const std::string& s) {
     return ss.str();
 }
 
+// pair index of each bracket byte, and whether it opens; pair -1 for anything else
+struct BracketClass {
+    int8_t pair;
+    bool open;
+};
+
+constexpr std::array<BracketClass, 256> bracket_table = [] {
+    std::array<BracketClass, 256> result{};
+    for (auto& c: result) {
+        c = {-1, false};
+    }
+    constexpr std::string_view opens = "([{<";
+    constexpr std::string_view closes = ")]}>";
+    for (int8_t i = 0; i < 4; i++) {
+        result[uint8_t(opens[i])] = {i, true};
+        result[uint8_t(closes[i])] = {i, false};
+    }
+    return result;
+}();
+
+constexpr std::array<uint64_t, 4> illegal_scores = {3, 57, 1197, 25137};
+
+struct Validation {
+    bool corrupt;
+    uint64_t score; // illegal character score when corrupt, completion score otherwise
+};
+
+// Validates lines in one pass, scoring the completion straight off the stack of open pairs.
+// The stack is kept between lines so it only grows to the longest line.
+struct Validator {
+    std::vector<int8_t> stack;
+
+    Validation validate(std::string_view line) {
+        if (stack.size() < line.size()) {
+            stack.resize(line.size());
+        }
+        int8_t* top = stack.data();
+
+        for (char c: line) {
+            BracketClass b = bracket_table[uint8_t(c)];
+            if (b.open) {
+                *top++ = b.pair;
+            } else if (top != stack.data() && b.pair == top[-1]) {
+                --top;
+            } else {
+                return {true, b.pair < 0 ? 0 : illegal_scores[b.pair]};
+            }
+        }
+
+        uint64_t total = 0;
+        while (top != stack.data()) {
+            total = total * 5 + *--top + 1;
+        }
+        return {false, total};
+    }
+};
+
+// What a segment of a line reduces to once its matched pairs are removed: closers with no opener
+// in the segment, then openers with no closer. Segments combine associatively, so a line can be
+// reduced in chunks and merged left to right. A segment stops at its first mismatched closer.
+struct Reduction {
+    std::optional<std::size_t> corrupt; // position of the first mismatched closer
+    std::vector<std::pair<std::size_t, int8_t>> closers;
+    std::vector<int8_t> openers;
+};
+
+Reduction reduce_segment(std::string_view segment, std::size_t offset) {
+    Reduction result;
+    for (std::size_t i = 0; i < segment.size(); i++) {
+        BracketClass b = bracket_table[uint8_t(segment[i])];
+        if (b.open) {
+            result.openers.push_back(b.pair);
+        } else if (result.openers.empty() && b.pair >= 0) {
+            result.closers.emplace_back(offset + i, b.pair);
+        } else if (!result.openers.empty() && result.openers.back() == b.pair) {
+            result.openers.pop_back();
+        } else {
+            result.corrupt = offset + i;
+            break;
+        }
+    }
+    return result;
+}
+
+// merges right into left, right being the segment immediately after left
+void merge(Reduction& left, Reduction&& right) {
+    if (left.corrupt) {
+        return;
+    }
+    for (auto [pos, pair]: right.closers) {
+        if (left.openers.empty()) {
+            left.closers.emplace_back(pos, pair);
+        } else if (left.openers.back() == pair) {
+            left.openers.pop_back();
+        } else {
+            left.corrupt = pos;
+            return;
+        }
+    }
+    left.corrupt = right.corrupt;
+    left.openers.insert(left.openers.end(), right.openers.begin(), right.openers.end());
+}
+
+Reduction reduce_parallel(std::string_view line, std::size_t chunk_count = thread_count()) {
+    chunk_count = std::clamp<std::size_t>(chunk_count, 1, std::max<std::size_t>(line.size(), 1));
+    std::vector<Reduction> reductions(chunk_count);
+    parallel_chunks(line.size(), chunk_count, [&](std::size_t i, std::size_t begin, std::size_t end) {
+        reductions[i] = reduce_segment(line.substr(begin, end - begin), begin);
+    });
+
+    Reduction result = std::move(reductions.front());
+    for (std::size_t i = 1; i < reductions.size() && !result.corrupt; i++) {
+        merge(result, std::move(reductions[i]));
+    }
+    return result;
+}
+
+// a closer with nothing left to close corrupts the line too
+std::optional<std::size_t> corrupting_position(const Reduction& r) {
+    if (!r.closers.empty() && (!r.corrupt || r.closers.front().first < *r.corrupt)) {
+        return r.closers.front().first;
+    }
+    return r.corrupt;
+}
+
+std::optional<char> find_corrupting_parallel(std::string_view line, std::size_t chunk_count = thread_count()) {
+    auto pos = corrupting_position(reduce_parallel(line, chunk_count));
+    if (pos) {
+        return line[*pos];
+    }
+    return std::nullopt;
+}
+
+std::optional<std::string> make_closing_string_parallel(std::string_view line, std::size_t chunk_count = thread_count()) {
+    auto r = reduce_parallel(line, chunk_count);
+    if (corrupting_position(r)) {
+        return std::nullopt;
+    }
+    std::string result(r.openers.size(), 0);
+    std::transform(r.openers.rbegin(), r.openers.rend(), result.begin(), [](int8_t pair) { return ")]}>"[pair]; });
+    return result;
+}
+
 int score_corrupt(const std::vector<std::string>& lines) {
+    Validator v;
     int total_score = 0;
-    for (auto line: lines) {
-        auto corr = find_corrupting(line);
-        if (corr) {
-            total_score += score_illegal_char(*corr);
+    for (const auto& line: lines) {
+        auto result = v.validate(line);
+        if (result.corrupt) {
+            total_score += result.score;
         }
     }
     return total_score;
 }
 
-uint64_t score_complete(const std::vector<std::string>& lines) {
+// the middle completion score, or nullopt when every line is corrupt
+std::optional<uint64_t> score_complete(const std::vector<std::string>& lines) {
+    Validator v;
     std::vector<uint64_t> scores;
-    for (auto line: lines) {
-        auto complete = make_closing_string(line);
-        if (complete) {
-            scores.push_back(score_complete_string(*complete));
+    for (const auto& line: lines) {
+        auto result = v.validate(line);
+        if (!result.corrupt) {
+            scores.push_back(result.score);
         }
     }
-    std::sort(scores.begin(), scores.end());
+    if (scores.empty()) {
+        return std::nullopt;
+    }
+    auto middle = scores.begin() + scores.size() / 2;
+    std::nth_element(scores.begin(), middle, scores.end());
 
-    return scores[scores.size() / 2];
+    return *middle;
 }
 
+// Median of a stream of scores, the upper middle one for an even count as in score_complete.
+// The lower half is a max heap and the upper half a min heap holding the median on top.
+struct RunningMedian {
+    std::priority_queue<uint64_t> lower;
+    std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<>> upper;
+
+    void add(uint64_t v) {
+        if (!upper.empty() && v < upper.top()) {
+            lower.push(v);
+        } else {
+            upper.push(v);
+        }
+        if (lower.size() > upper.size()) {
+            upper.push(lower.top());
+            lower.pop();
+        } else if (upper.size() > lower.size() + 1) {
+            lower.push(upper.top());
+            upper.pop();
+        }
+    }
+
+    std::size_t size() const {
+        return lower.size() + upper.size();
+    }
+
+    // nullopt until the first score arrives
+    std::optional<uint64_t> median() const {
+        if (upper.empty()) {
+            return std::nullopt;
+        }
+        return upper.top();
+    }
+};
+
+// scores lines as they arrive, keeping both totals current
+struct StreamScorer {
+    Validator validator;
+    RunningMedian completions;
+    uint64_t corrupt_total = 0;
+
+    void add(std::string_view line) {
+        auto result = validator.validate(line);
+        if (result.corrupt) {
+            corrupt_total += result.score;
+        } else {
+            completions.add(result.score);
+        }
+    }
+
+    std::optional<uint64_t> complete_median() const {
+        return completions.median();
+    }
+};
+
 TEST_CASE("day10e", "[aoc2021]") {
     auto lines = slurp("day10example.txt");
 
     REQUIRE(score_corrupt(lines) == 26397);
 
     REQUIRE(score_complete(lines) == 288957);
+    REQUIRE(score_complete({"{([(<{}[<>[]}>{[]{[(<()>", "[[<[([]))<([[{}[[()]]]"}) == std::nullopt);
+
+    Validator v;
+    for (const auto& line: lines) {
+        auto result = v.validate(line);
+        auto corr = find_corrupting(line);
+        REQUIRE(result.corrupt == corr.has_value());
+        if (corr) {
+            REQUIRE(result.score == uint64_t(score_illegal_char(*corr)));
+        } else {
+            REQUIRE(result.score == score_complete_string(*make_closing_string(line)));
+        }
+    }
 }
 
 TEST_CASE("day10", "[aoc2021]") {
@@ -145,3 +365,62 @@ TEST_CASE("day10", "[aoc2021]") {
 
     REQUIRE(score_complete(lines) == 4361305341);
 }
+
+TEST_CASE("day10 parallel", "[aoc2021]") {
+    auto lines = slurp("day10.txt");
+
+    for (const auto& line: lines) {
+        auto corr = find_corrupting(line);
+        auto closing = make_closing_string(line);
+        for (std::size_t chunks: {std::size_t{1}, std::size_t{2}, std::size_t{5}, line.size() / 3, line.size()}) {
+            REQUIRE(find_corrupting_parallel(line, chunks) == corr);
+            REQUIRE(make_closing_string_parallel(line, chunks) == closing);
+        }
+    }
+
+    // one long line: a random nest of pairs, cut short, then corrupted near the end
+    std::mt19937 rng(10);
+    std::string line;
+    std::string open;
+    for (int i = 0; i < 1000000; i++) {
+        if (open.empty() || rng() % 2) {
+            int pair = rng() % 4;
+            line.push_back("([{<"[pair]);
+            open.push_back(")]}>"[pair]);
+        } else {
+            line.push_back(open.back());
+            open.pop_back();
+        }
+    }
+
+    auto closing = make_closing_string(line);
+    REQUIRE(closing);
+    REQUIRE(make_closing_string_parallel(line, 64) == closing);
+
+    line.push_back(closing->front() == ')' ? ']' : ')');
+    auto corr = find_corrupting(line);
+    REQUIRE(corr);
+    REQUIRE(find_corrupting_parallel(line, 64) == corr);
+    REQUIRE(make_closing_string_parallel(line, 64) == std::nullopt);
+}
+
+TEST_CASE("day10 stream", "[aoc2021]") {
+    auto lines = slurp("day10.txt");
+
+    StreamScorer scorer;
+    REQUIRE(scorer.complete_median() == std::nullopt);
+
+    std::vector<std::string> seen;
+    for (const auto& line: lines) {
+        scorer.add(line);
+        seen.push_back(line);
+        if (scorer.completions.size() > 0) {
+            REQUIRE(scorer.complete_median() == score_complete(seen));
+        } else {
+            REQUIRE(scorer.complete_median() == std::nullopt);
+        }
+    }
+
+    REQUIRE(scorer.corrupt_total == 318081);
+    REQUIRE(scorer.complete_median() == 4361305341);
+}
@@ -1,107 +1,242 @@
 #include "util.h"
+#include <thread>
+#include <barrier>
 
 namespace day11 {
-    struct Octopus {
-        int energy;
-        int flash_time; // update number of the last flash
+    // A horizontal band of rows stepped by one thread. Bumps to rows owned by the band above or
+    // below are queued in its halos and applied by the owner once every band has settled.
+    struct Band {
+        int y0;
+        int y1;
+        std::vector<int> flashing; // worklist of octopi that flashed this round
+        std::size_t next;          // first entry of flashing not yet propagated
+        std::vector<int> halo_up;
+        std::vector<int> halo_down;
     };
 
+    // Energies are stored one byte per octopus with a one cell border, so every neighbor is a
+    // fixed offset away. Border cells are reset every round and take at most three bumps, so they
+    // never flash.
     struct Map {
-        std::vector<Octopus> octopi;
+        std::vector<uint8_t> energy;
         int width;
         int height;
+        int stride;
         int round;
-        int total_flashes;
+        uint64_t total_flashes;
+        std::array<int, 8> neighbors;
+        std::vector<Band> bands;
 
-        Map(int w, int h) : octopi(w*h), width(w), height(h), round(0) {}
+        // Bands are stepped on threads started afresh for every round, so a band needs enough
+        // octopi to pay for its thread. Small grids like the puzzle's run as a single band.
+        static constexpr int band_cells = 1 << 16;
 
-        Octopus& at(int x, int y) {
-            return octopi[y * width + x];
+        static int default_band_count(int w, int h) {
+            return std::clamp(int(std::size_t(w) * h / band_cells), 1, int(thread_count()));
         }
 
-        void update_octopus(int x, int y, std::function<void(Octopus&)> f) {
-           if (x < 0 || y < 0 || x >= height || y >= height) {
-               return;
-           }
-           f(octopi[y * width + x]);
+        Map(int w, int h) : Map(w, h, default_band_count(w, h)) {}
+
+        Map(int w, int h, int band_count)
+                : energy((w+2)*(h+2), 0), width(w), height(h), stride(w+2), round(0), total_flashes(0),
+                  neighbors{-stride-1, -stride, -stride+1, -1, 1, stride-1, stride, stride+1} {
+            set_band_count(band_count);
+        }
+
+        void set_band_count(int count) {
+            count = std::clamp(count, 1, std::max(height, 1));
+            bands.clear();
+            for (int b = 0; b < count; b++) {
+                bands.push_back({height * b / count, height * (b+1) / count, {}, 0, {}, {}});
+            }
+        }
+
+        int index(int x, int y) const {
+            return (y+1) * stride + x + 1;
+        }
+
+        uint8_t& at(int x, int y) {
+            return energy[index(x, y)];
         }
 
-        void flash(int x, int y, int t) {
-            update_octopus(x, y,     [t](Octopus& o) { o.flash_time = t; });
-            update_octopus(x-1, y-1, [t](Octopus& o) { o.energy++; });
-            update_octopus(x-1, y,   [t](Octopus& o) { o.energy++; });
-            update_octopus(x-1, y+1, [t](Octopus& o) { o.energy++; });
-            update_octopus(x+1, y-1, [t](Octopus& o) { o.energy++; });
-            update_octopus(x+1, y,   [t](Octopus& o) { o.energy++; });
-            update_octopus(x+1, y+1, [t](Octopus& o) { o.energy++; });
-            update_octopus(x, y-1,   [t](Octopus& o) { o.energy++; });
-            update_octopus(x, y+1,   [t](Octopus& o) { o.energy++; });
+        uint8_t at(int x, int y) const {
+            return energy[index(x, y)];
         }
 
-        void update() {
-            for (auto& o: octopi) {
-                o.energy++;
+        void reset_border() {
+            std::fill_n(&at(-1, -1), stride, 0);
+            std::fill_n(&at(-1, height), stride, 0);
+            for (int y = 0; y < height; y++) {
+                at(-1, y) = 0;
+                at(width, y) = 0;
             }
+        }
 
-            int flashes = 0;
-            do {
-                flashes = 0;
+        // the rows a band writes directly, including the border row beside the top or bottom band
+        std::pair<int,int> owned_rows(const Band& b) const {
+            return {b.y0 == 0 ? -1 : b.y0, b.y1 == height ? height + 1 : b.y1};
+        }
 
-                for (int y = 0; y < height; y++) {
+        void bump(Band& b, int i) {
+            if (++energy[i] == 10) {
+                b.flashing.push_back(i);
+            }
+        }
+
+        void propagate(Band& b) {
+            auto [first, last] = owned_rows(b);
+            int lo = index(-1, first);
+            int hi = index(-1, last);
+            for (; b.next < b.flashing.size(); b.next++) {
+                int i = b.flashing[b.next];
+                for (int n: neighbors) {
+                    int j = i + n;
+                    if (j < lo) {
+                        b.halo_up.push_back(j);
+                    } else if (j >= hi) {
+                        b.halo_down.push_back(j);
+                    } else {
+                        bump(b, j);
+                    }
+                }
+            }
+        }
+
+        // applies the bumps the bands either side of band i queued for it
+        void take_halos(std::size_t i) {
+            Band& b = bands[i];
+            if (i > 0) {
+                for (int j: bands[i-1].halo_down) {
+                    bump(b, j);
+                }
+            }
+            if (i + 1 < bands.size()) {
+                for (int j: bands[i+1].halo_up) {
+                    bump(b, j);
+                }
+            }
+        }
+
+        // One thread per band, alive for the whole round. Every band increments its rows and
+        // propagates its own flashes, then all meet at the barrier. If any bumps crossed a band
+        // edge, each band takes those queued for it and the bands meet again before the next
+        // propagation clears the halos. An octopus joins a worklist the moment its energy reaches
+        // 10, so each flashes at most once. Returns the number of flashes.
+        int update() {
+            std::barrier sync(bands.size());
+            parallel_chunks(bands.size(), bands.size(), [&](std::size_t i, std::size_t, std::size_t) {
+                Band& b = bands[i];
+                b.flashing.clear();
+                b.next = 0;
+                for (int y = b.y0; y < b.y1; y++) {
+                    uint8_t* row = &at(0, y);
+                    for (int x = 0; x < width; x++) {
+                        row[x]++;
+                    }
                     for (int x = 0; x < width; x++) {
-                        auto& o = octopi[y * width + x];
-                        if (o.flash_time != round && o.energy > 9) {
-                            flash(x, y, round);
-                            flashes++;
-                            total_flashes++;
+                        if (row[x] == 10) {
+                            b.flashing.push_back(index(x, y));
                         }
                     }
                 }
-            } while (flashes > 0);
 
-            for (auto& o: octopi) {
-                if (o.energy > 9) {
-                    o.energy = 0;
+                while (true) {
+                    b.halo_up.clear();
+                    b.halo_down.clear();
+                    propagate(b);
+                    sync.arrive_and_wait();
+
+                    bool crossing = std::any_of(bands.begin(), bands.end(), [](const Band& o) {
+                        return !o.halo_up.empty() || !o.halo_down.empty();
+                    });
+                    if (!crossing) {
+                        break;
+                    }
+                    take_halos(i);
+                    sync.arrive_and_wait();
                 }
+            });
+
+            int flashes = 0;
+            for (auto& b: bands) {
+                for (int i: b.flashing) {
+                    energy[i] = 0;
+                }
+                flashes += b.flashing.size();
             }
+            reset_border();
 
+            total_flashes += flashes;
             round++;
+            return flashes;
         }
 
+        // Brent's cycle detection: the state saved at rounds a power of two apart is compared with
+        // every state after it, so a repeat is found holding one copy of the grid. Once it is,
+        // the rest of the run is whole periods, skipped at once, plus a remainder.
         void update(int count) {
-            while(count--) {
+            int target = round + count;
+            std::vector<uint8_t> saved = energy;
+            uint64_t saved_flashes = total_flashes;
+            int power = 1;
+            int since = 0; // rounds since saved
+
+            while (round < target) {
                 update();
+                since++;
+                if (energy == saved) {
+                    int cycles = (target - round) / since;
+                    total_flashes += uint64_t(cycles) * (total_flashes - saved_flashes);
+                    round += cycles * since;
+                    while (round < target) {
+                        update();
+                    }
+                    return;
+                }
+                if (since == power) {
+                    saved = energy;
+                    saved_flashes = total_flashes;
+                    power *= 2;
+                    since = 0;
+                }
             }
         }
 
-        int update_until_sync() {
-            int flashed_this_round = 0;
-            do {
-                update();
+        // The round on which every octopus first flashes, or nullopt if states cycle before that.
+        // A repeat is only seen after the whole cycle has been stepped through, so no synchronized
+        // round in it can be missed.
+        std::optional<int> update_until_sync() {
+            std::vector<uint8_t> saved = energy;
+            int power = 1;
+            int since = 0;
 
-                flashed_this_round = 0;
-                int rnd = round-1;
-
-                for (auto& o: octopi) {
-                    if (o.flash_time == rnd) {
-                        flashed_this_round++;
-                    }
+            while (true) {
+                if (update() == width * height) {
+                    return round;
+                }
+                since++;
+                if (energy == saved) {
+                    return std::nullopt;
                 }
-            } while (flashed_this_round != octopi.size());
-            return round;
+                if (since == power) {
+                    saved = energy;
+                    power *= 2;
+                    since = 0;
+                }
+            }
         }
 
         void print() {
             std::cout << "Round: " << round << " flashes: " << total_flashes << "\n";
             for (int y = 0; y < height; y++) {
                 for (int x = 0; x < width; x++) {
-                    auto &o = octopi[y * width + x];
-                    std::cout << o.energy;
+                    std::cout << int(at(x, y));
                 }
                 std::cout << "\n";
             }
         }
     };
+
     Map parse_map(const std::string& path) {
         auto lines = slurp(path);
         int width = lines[0].size();
@@ -109,9 +244,9 @@ namespace day11 {
         Map result(width, height);
 
         for (int y = 0; y < height; y++) {
-            auto line = lines[y];
+            const auto& line = lines[y];
             for (int x = 0; x < width; x++) {
-                result.at(x, y).energy = line[x] - '0';
+                result.at(x, y) = line[x] - '0';
             }
         }
 
@@ -130,20 +265,53 @@ TEST_CASE("day11e", "[aoc2021]") {
 
     REQUIRE(m.total_flashes == 1656);
 
-    int sync = m.update_until_sync();
+    auto sync = m.update_until_sync();
 
     REQUIRE(sync == 195);
 }
 
 TEST_CASE("day11", "[aoc2021]") {
     day11::Map m = day11::parse_map("day11.txt");
+    REQUIRE(m.bands.size() == 1);
 
     m.update(100);
 
     REQUIRE(m.total_flashes == 1601);
 
-    int sync = m.update_until_sync();
+    auto sync = m.update_until_sync();
 
     REQUIRE(sync == 368);
 }
 
+TEST_CASE("day11 bands", "[aoc2021]") {
+    REQUIRE(day11::Map(1024, 1024).bands.size() == std::min<std::size_t>(16, thread_count()));
+
+    for (int count: {2, 3, 5, 10}) {
+        day11::Map reference = day11::parse_map("day11.txt");
+        reference.set_band_count(1);
+        day11::Map m = day11::parse_map("day11.txt");
+        m.set_band_count(count);
+
+        for (int r = 0; r < 400; r++) {
+            REQUIRE(m.update() == reference.update());
+            REQUIRE(m.energy == reference.energy);
+        }
+    }
+}
+
+TEST_CASE("day11 cycles", "[aoc2021]") {
+    // once synchronized the grid flashes together every 10 rounds
+    day11::Map m = day11::parse_map("day11example.txt");
+    m.update(195);
+    uint64_t flashes = m.total_flashes;
+
+    m.update(1000000000);
+    REQUIRE(m.round == 1000000195);
+    REQUIRE(m.total_flashes == flashes + 100000000ull * 100);
+
+    // two octopi half a cycle apart keep bumping each other back out of step
+    day11::Map pair(2, 1);
+    pair.at(0, 0) = 0;
+    pair.at(1, 0) = 5;
+    REQUIRE(pair.update_until_sync() == std::nullopt);
+}
@@ -1,4 +1,6 @@
 #include "util.h"
+#include <span>
+#include <atomic>
 
 namespace day12 {
     struct Node {
@@ -13,19 +15,279 @@ namespace day12 {
 
     using Path = std::vector<std::size_t>;
 
+    // Counts of visits to each small cave, held as bit planes: bit i of plane p is bit p of the
+    // count for the small cave with bit index i. Four planes allow up to 15 visits.
+    struct VisitState {
+        std::size_t node;
+        bool doubled; // a small cave has already been visited twice when small_visit_max is 2
+        std::array<uint64_t, 4> planes;
+
+        bool operator==(const VisitState&) const = default;
+
+        int count(int bit) const {
+            int result = 0;
+            for (int p = 0; p < 4; p++) {
+                result |= ((planes[p] >> bit) & 1) << p;
+            }
+            return result;
+        }
+
+        void set_count(int bit, int c) {
+            for (int p = 0; p < 4; p++) {
+                planes[p] = (planes[p] & ~(uint64_t(1) << bit)) | (uint64_t((c >> p) & 1) << bit);
+            }
+        }
+    };
+
+    struct VisitStateHash {
+        std::size_t operator()(const VisitState& s) const {
+            std::size_t h = std::hash<std::size_t>()(s.node * 2 + s.doubled);
+            for (uint64_t p: s.planes) {
+                h = h * 0x9e3779b97f4a7c15ull + std::hash<uint64_t>()(p);
+            }
+            return h;
+        }
+    };
+
+    // Adjacency compiled for searching from start to end: neighbors of n are
+    // neighbors[offsets[n]..offsets[n+1]), with edges back into start or out of end removed.
+    struct Csr {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> neighbors;
+        std::vector<uint8_t> big;
+        uint32_t start;
+        uint32_t end;
+
+        std::span<const uint32_t> adjacent(uint32_t n) const {
+            return {neighbors.data() + offsets[n], neighbors.data() + offsets[n+1]};
+        }
+
+        // Whether a small cave already visited the given number of times may be entered again.
+        // Only one small cave may be visited twice, so doubled is set when this uses that visit.
+        static bool admit_small(std::size_t visits, std::size_t small_visit_max, bool& doubled) {
+            if (visits >= small_visit_max) {
+                return false;
+            }
+            if (small_visit_max == 2 && visits == 1) {
+                if (doubled) {
+                    return false;
+                }
+                doubled = true;
+            }
+            return true;
+        }
+
+        bool admit(uint32_t m, const std::vector<uint8_t>& visits, std::size_t small_visit_max, bool& doubled) const {
+            return big[m] || admit_small(visits[m], small_visit_max, doubled);
+        }
+
+        // visits holds the visits made to each cave on the current path
+        uint64_t count_from(uint32_t n, std::vector<uint8_t>& visits, bool doubled, std::size_t small_visit_max) const {
+            if (n == end) {
+                return 1;
+            }
+
+            uint64_t total = 0;
+            for (uint32_t m: adjacent(n)) {
+                bool d = doubled;
+                if (!admit(m, visits, small_visit_max, d)) {
+                    continue;
+                }
+                visits[m]++;
+                total += count_from(m, visits, d, small_visit_max);
+                visits[m]--;
+            }
+            return total;
+        }
+
+        uint64_t count_paths(std::size_t small_visit_max = 1) const {
+            std::vector<uint8_t> visits(big.size());
+            return count_from(start, visits, false, small_visit_max);
+        }
+
+        // Partial paths left for workers to count the rest of. Each prefix holds the depth caves
+        // after start; a worker rebuilds the visits along it instead of every prefix storing them.
+        struct Subtrees {
+            std::size_t depth;
+            std::vector<uint32_t> prefixes;
+            std::vector<uint8_t> doubled;
+
+            std::size_t size() const {
+                return doubled.size();
+            }
+
+            std::span<const uint32_t> prefix(std::size_t i) const {
+                return {prefixes.data() + i * depth, depth};
+            }
+        };
+
+        // Follows count_from down to subtrees.depth levels, collecting the subtrees there and
+        // counting paths that finish sooner. path holds the caves entered after start.
+        uint64_t split(uint32_t n, std::vector<uint8_t>& visits, std::vector<uint32_t>& path, bool doubled,
+                       std::size_t small_visit_max, Subtrees& subtrees) const {
+            if (n == end) {
+                return 1;
+            }
+            if (path.size() == subtrees.depth) {
+                subtrees.prefixes.insert(subtrees.prefixes.end(), path.begin(), path.end());
+                subtrees.doubled.push_back(doubled);
+                return 0;
+            }
+
+            uint64_t total = 0;
+            for (uint32_t m: adjacent(n)) {
+                bool d = doubled;
+                if (!admit(m, visits, small_visit_max, d)) {
+                    continue;
+                }
+                visits[m]++;
+                path.push_back(m);
+                total += split(m, visits, path, d, small_visit_max, subtrees);
+                path.pop_back();
+                visits[m]--;
+            }
+            return total;
+        }
+
+        // Counts the subtrees below cutoff levels as independent tasks. Subtrees come out in DFS
+        // order, where heavy ones sit side by side, so rather than taking fixed slices each worker
+        // pulls the next subtree off a shared index and keeps its own sum.
+        uint64_t count_paths_parallel(std::size_t small_visit_max = 1, int cutoff = 4,
+                                      std::size_t workers = thread_count()) const {
+            std::vector<uint8_t> visits(big.size());
+            std::vector<uint32_t> path;
+            Subtrees subtrees{std::size_t(std::max(cutoff, 0)), {}, {}};
+            uint64_t shallow = split(start, visits, path, false, small_visit_max, subtrees);
+
+            workers = std::clamp<std::size_t>(workers, 1, std::max<std::size_t>(subtrees.size(), 1));
+            std::atomic<std::size_t> next = 0;
+            std::vector<uint64_t> sums(workers);
+            parallel_chunks(workers, workers, [&](std::size_t w, std::size_t, std::size_t) {
+                std::vector<uint8_t> v(big.size());
+                for (std::size_t i = next++; i < subtrees.size(); i = next++) {
+                    auto prefix = subtrees.prefix(i);
+                    for (uint32_t m: prefix) {
+                        v[m]++;
+                    }
+                    sums[w] += count_from(prefix.empty() ? start : prefix.back(), v, subtrees.doubled[i], small_visit_max);
+                    for (uint32_t m: prefix) {
+                        v[m]--;
+                    }
+                }
+            });
+            return std::accumulate(sums.begin(), sums.end(), shallow);
+        }
+    };
+
+    // Walks the paths from start to end one at a time with an explicit DFS stack. path() views
+    // the stack and is only valid until the next call to next(). Memory is linear in the depth.
+    struct PathEnumerator {
+        const Csr& csr;
+        std::size_t small_visit_max;
+        std::vector<uint32_t> stack;     // the current path
+        std::vector<uint32_t> next_edge; // per depth, the next neighbor to try
+        std::vector<uint8_t> doubled;    // per depth, whether the double visit has been used
+        std::vector<uint8_t> visits;
+
+        PathEnumerator(const Csr& g, std::size_t max = 1) : csr(g), small_visit_max(max), stack{g.start},
+                                                            next_edge{g.offsets[g.start]}, doubled{false}, visits(g.big.size()) {
+            visits[g.start] = 1;
+        }
+
+        void pop() {
+            visits[stack.back()]--;
+            stack.pop_back();
+            next_edge.pop_back();
+            doubled.pop_back();
+        }
+
+        // advances to the next path, false once every path has been visited
+        bool next() {
+            if (!stack.empty() && stack.back() == csr.end) {
+                pop();
+            }
+            while (!stack.empty()) {
+                uint32_t n = stack.back();
+                if (next_edge.back() == csr.offsets[n+1]) {
+                    pop();
+                    continue;
+                }
+
+                uint32_t m = csr.neighbors[next_edge.back()++];
+                bool d = doubled.back();
+                if (!csr.admit(m, visits, small_visit_max, d)) {
+                    continue;
+                }
+
+                visits[m]++;
+                stack.push_back(m);
+                next_edge.push_back(csr.offsets[m]);
+                doubled.push_back(d);
+                if (m == csr.end) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::span<const uint32_t> path() const {
+            return stack;
+        }
+    };
+
+    // Hands each path to sink until it returns false, returns how many paths were handed over.
+    std::size_t for_each_path(const Csr& csr, std::size_t small_visit_max, auto sink) {
+        PathEnumerator paths(csr, small_visit_max);
+        std::size_t count = 0;
+        while (paths.next()) {
+            count++;
+            if (!sink(paths.path())) {
+                break;
+            }
+        }
+        return count;
+    }
+
     struct Graph {
         std::vector<Node> nodes{};
         std::vector<std::pair<int,int>> edges{};
+        std::unordered_map<std::string, std::size_t> ids{};
 
         std::size_t find_or_insert(const std::string& name) {
-            auto it = std::find_if(nodes.begin(), nodes.end(), [name](const auto& x) { return x.name == name; });
-            if (it == nodes.end()) {
-                std::size_t id = nodes.size();
+            auto [it, inserted] = ids.try_emplace(name, nodes.size());
+            if (inserted) {
                 nodes.push_back({name, is_big(name)});
-                return id;
-            } else {
-                return it - nodes.begin();
             }
+            return it->second;
+        }
+
+        Csr compile(std::size_t start, std::size_t end) const {
+            Csr result{std::vector<uint32_t>(nodes.size() + 1), {}, {}, uint32_t(start), uint32_t(end)};
+            std::vector<std::pair<uint32_t, uint32_t>> arcs;
+            for (auto [a, b]: edges) {
+                if (b != int(start) && a != int(end)) {
+                    arcs.emplace_back(a, b);
+                }
+                if (a != int(start) && b != int(end)) {
+                    arcs.emplace_back(b, a);
+                }
+            }
+
+            for (auto [from, to]: arcs) {
+                result.offsets[from + 1]++;
+            }
+            std::partial_sum(result.offsets.begin(), result.offsets.end(), result.offsets.begin());
+
+            result.neighbors.resize(arcs.size());
+            std::vector<uint32_t> fill(result.offsets.begin(), result.offsets.end() - 1);
+            for (auto [from, to]: arcs) {
+                result.neighbors[fill[from]++] = to;
+            }
+
+            for (const auto& n: nodes) {
+                result.big.push_back(n.big);
+            }
+            return result;
         }
 
         void add_edge(const std::string& a, const std::string& b) {
@@ -59,6 +321,54 @@ namespace day12 {
             std::cout << "\n";
         }
 
+        // Counts the paths paths_from would return without building them, memoized on the
+        // current cave and the visits made to small caves so far.
+        uint64_t count_paths(std::size_t start, std::size_t end, std::size_t small_visit_max = 1) {
+            std::vector<int> small_bit(nodes.size(), -1);
+            int small_count = 0;
+            for (std::size_t n = 0; n < nodes.size(); n++) {
+                // start can't be revisited and end finishes the path, so neither needs tracking
+                if (small(n) && n != start && n != end) {
+                    small_bit[n] = small_count++;
+                }
+            }
+            if (small_count > 64 || small_visit_max > 15) {
+                fail(std::format("can't count paths over {} small caves visited up to {} times", small_count, small_visit_max));
+            }
+
+            Csr csr = compile(start, end);
+
+            std::unordered_map<VisitState, uint64_t, VisitStateHash> memo;
+
+            auto count = [&](auto& self, const VisitState& state) -> uint64_t {
+                if (state.node == end) {
+                    return 1;
+                }
+                if (auto it = memo.find(state); it != memo.end()) {
+                    return it->second;
+                }
+
+                uint64_t total = 0;
+                for (std::size_t n: csr.adjacent(state.node)) {
+                    VisitState next = state;
+                    next.node = n;
+                    if (small_bit[n] >= 0) {
+                        int visits = state.count(small_bit[n]);
+                        if (!Csr::admit_small(visits, small_visit_max, next.doubled)) {
+                            continue;
+                        }
+                        next.set_count(small_bit[n], visits + 1);
+                    }
+                    total += self(self, next);
+                }
+
+                memo.emplace(state, total);
+                return total;
+            };
+
+            return count(count, VisitState{start, false, {}});
+        }
+
         std::vector<Path> paths_from(const Path& p, std::size_t end, std::size_t small_visit_max = 1) {
             std::vector<Path> result{};
 
@@ -147,3 +457,121 @@ TEST_CASE("day12p2", "[aoc2021]") {
     REQUIRE(count == 147784);
 }
 
+
+TEST_CASE("day12 count", "[aoc2021]") {
+    for (auto path: {"day12example.txt", "day12example2.txt", "day12.txt"}) {
+        day12::Graph g = day12::parse_graph(path);
+        std::size_t start = g.find_or_insert("start");
+        std::size_t end = g.find_or_insert("end");
+        for (std::size_t max: {1, 2}) {
+            REQUIRE(g.count_paths(start, end, max) == g.paths_from({start}, end, max).size());
+        }
+    }
+
+    day12::Graph g = day12::parse_graph("day12example.txt");
+    std::size_t start = g.find_or_insert("start");
+    std::size_t end = g.find_or_insert("end");
+    REQUIRE(g.count_paths(start, end, 3) == g.paths_from({start}, end, 3).size());
+
+    g = day12::parse_graph("day12.txt");
+    REQUIRE(g.count_paths(g.find_or_insert("start"), g.find_or_insert("end"), 2) == 147784);
+}
+
+TEST_CASE("day12 csr", "[aoc2021]") {
+    day12::Graph g = day12::parse_graph("day12example.txt");
+    auto csr = g.compile(g.find_or_insert("start"), g.find_or_insert("end"));
+    REQUIRE(csr.count_paths(1) == 10);
+    REQUIRE(csr.count_paths(2) == 36);
+    REQUIRE(csr.adjacent(csr.end).empty());
+    for (uint32_t n = 0; n < g.nodes.size(); n++) {
+        auto adjacent = csr.adjacent(n);
+        REQUIRE(std::find(adjacent.begin(), adjacent.end(), csr.start) == adjacent.end());
+    }
+
+    g = day12::parse_graph("day12example2.txt");
+    csr = g.compile(g.find_or_insert("start"), g.find_or_insert("end"));
+    REQUIRE(csr.count_paths(1) == 19);
+    REQUIRE(csr.count_paths(2) == 103);
+
+    g = day12::parse_graph("day12.txt");
+    csr = g.compile(g.find_or_insert("start"), g.find_or_insert("end"));
+    REQUIRE(csr.count_paths(1) == 5252);
+    REQUIRE(csr.count_paths(2) == 147784);
+}
+
+TEST_CASE("day12 count many caves", "[aoc2021]") {
+    // a ladder of 64 small caves, each rung reachable through a big cave on either side
+    day12::Graph g;
+    g.add_edge("start", "c0");
+    for (int i = 0; i < 63; i++) {
+        auto a = std::format("c{}", i);
+        auto b = std::format("c{}", i + 1);
+        g.add_edge(a, std::format("L{}", i));
+        g.add_edge(std::format("L{}", i), b);
+        g.add_edge(a, std::format("R{}", i));
+        g.add_edge(std::format("R{}", i), b);
+    }
+    g.add_edge("c63", "end");
+
+    // every rung doubles the paths, and no detour back down the ladder can reach the end
+    uint64_t count = g.count_paths(g.find_or_insert("start"), g.find_or_insert("end"), 1);
+    REQUIRE(count == uint64_t(1) << 63);
+}
+
+TEST_CASE("day12 enumerate", "[aoc2021]") {
+    for (auto path: {"day12example.txt", "day12example2.txt", "day12.txt"}) {
+        day12::Graph g = day12::parse_graph(path);
+        std::size_t start = g.find_or_insert("start");
+        std::size_t end = g.find_or_insert("end");
+        auto csr = g.compile(start, end);
+
+        for (std::size_t max: {1, 2}) {
+            std::vector<day12::Path> expected = g.paths_from({start}, end, max);
+            std::vector<day12::Path> streamed;
+            day12::for_each_path(csr, max, [&](std::span<const uint32_t> p) {
+                streamed.emplace_back(p.begin(), p.end());
+                return true;
+            });
+            std::sort(expected.begin(), expected.end());
+            std::sort(streamed.begin(), streamed.end());
+            REQUIRE(streamed == expected);
+        }
+    }
+
+    day12::Graph g = day12::parse_graph("day12.txt");
+    auto csr = g.compile(g.find_or_insert("start"), g.find_or_insert("end"));
+    std::size_t seen = day12::for_each_path(csr, 2, [](std::span<const uint32_t>) { return false; });
+    REQUIRE(seen == 1);
+
+    // batch paths into a flat buffer, flushing every 1000
+    std::vector<uint32_t> batch;
+    std::size_t batched = 0;
+    std::size_t flushes = 0;
+    std::size_t total = day12::for_each_path(csr, 2, [&](std::span<const uint32_t> p) {
+        batch.insert(batch.end(), p.begin(), p.end());
+        if (++batched % 1000 == 0) {
+            batch.clear();
+            flushes++;
+        }
+        return true;
+    });
+    REQUIRE(total == 147784);
+    REQUIRE(flushes == 147);
+}
+
+TEST_CASE("day12 parallel", "[aoc2021]") {
+    day12::Graph g = day12::parse_graph("day12.txt");
+    auto csr = g.compile(g.find_or_insert("start"), g.find_or_insert("end"));
+
+    for (int cutoff: {0, 1, 2, 4, 8, 64}) {
+        REQUIRE(csr.count_paths_parallel(1, cutoff) == 5252);
+        REQUIRE(csr.count_paths_parallel(2, cutoff) == 147784);
+    }
+    for (std::size_t workers: {1, 3, 16}) {
+        REQUIRE(csr.count_paths_parallel(2, 6, workers) == 147784);
+    }
+
+    g = day12::parse_graph("day12example2.txt");
+    csr = g.compile(g.find_or_insert("start"), g.find_or_insert("end"));
+    REQUIRE(csr.count_paths_parallel(2) == 103);
+}
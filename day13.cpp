@@ -1,63 +1,133 @@
 #include "util.h"
+#include <bit>
 
 namespace day13 {
 
+    uint64_t reverse_bits(uint64_t v) {
+        v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+        v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+        v = ((v >> 4) & 0x0f0f0f0f0f0f0f0full) | ((v & 0x0f0f0f0f0f0f0f0full) << 4);
+        return __builtin_bswap64(v);
+    }
+
+    // Rows are packed 64 cells to a word, bit x % 64 of word x / 64. Folds happen in place and
+    // only shrink the logical width and height, so the row stride stays as constructed. Bits at
+    // or past the width are always clear.
     struct Paper {
         std::size_t width;
         std::size_t height;
-        std::vector<bool> marks;
+        std::size_t words_per_row;
+        std::vector<uint64_t> bits;
 
-        Paper(std::size_t w, std::size_t h) : marks(w*h), width(w), height(h) {}
+        Paper(std::size_t w, std::size_t h) : width(w), height(h), words_per_row((w + 63) / 64), bits(words_per_row * h) {}
+
+        uint64_t* row(std::size_t y) {
+            return &bits[y * words_per_row];
+        }
+
+        const uint64_t* row(std::size_t y) const {
+            return &bits[y * words_per_row];
+        }
 
         bool marked(std::size_t x, std::size_t y) const {
-            return marks[y * width + x];
+            return (row(y)[x / 64] >> (x % 64)) & 1;
         }
 
         void mark(std::size_t x, std::size_t y) {
-            marks[y * width + x] = true;
+            row(y)[x / 64] |= uint64_t(1) << (x % 64);
         }
 
         int mark_count() const {
-            return std::count(marks.begin(), marks.end(), true);
+            int count = 0;
+            std::size_t words = (width + 63) / 64;
+            for (std::size_t y = 0; y < height; y++) {
+                for (std::size_t i = 0; i < words; i++) {
+                    count += std::popcount(row(y)[i]);
+                }
+            }
+            return count;
         }
 
-        Paper hfold(std::size_t at) const {
-            Paper result(width, at);
-
+        // ORs each row below the fold into its mirror above
+        void hfold_in_place(std::size_t at) {
+            std::size_t words = (width + 63) / 64;
             for (std::size_t y = 0; y < at; y++) {
-                for (std::size_t x = 0; x < width; x++) {
-                    if (marked(x, y) || marked(x, 2 * at - y)) {
-                        result.mark(x, y);
+                if (2 * at - y < height) {
+                    const uint64_t* from = row(2 * at - y);
+                    uint64_t* to = row(y);
+                    for (std::size_t i = 0; i < words; i++) {
+                        to[i] |= from[i];
                     }
                 }
             }
-
-            return result;
+            height = std::min(height, at);
         }
 
-        Paper vfold(std::size_t at) const {
-            Paper result(at, height);
+        // Reverses each row so bit j holds cell W-1-j for the stride width W, then shifts it so
+        // bit x holds cell 2*at-x and ORs it into the cells left of the fold.
+        void vfold_in_place(std::size_t at) {
+            std::size_t n = words_per_row;
+            std::vector<uint64_t> reversed(n);
+            int64_t shift = int64_t(n * 64) - 1 - 2 * int64_t(at);
+            int64_t q = (shift >= 0 ? shift : -shift) / 64;
+            int r = (shift >= 0 ? shift : -shift) % 64;
 
-            for (std::size_t x = 0; x < at; x++) {
-                for (std::size_t y = 0; y < height; y++) {
-                    if (marked(x, y) || marked(2 * at - x, y)) {
-                        result.mark(x, y);
+            auto word = [&](int64_t i) -> uint64_t {
+                return i >= 0 && i < int64_t(n) ? reversed[i] : 0;
+            };
+
+            for (std::size_t y = 0; y < height; y++) {
+                uint64_t* cells = row(y);
+                for (std::size_t i = 0; i < n; i++) {
+                    reversed[i] = reverse_bits(cells[n - 1 - i]);
+                }
+
+                for (std::size_t i = 0; i < n; i++) {
+                    int64_t j = int64_t(i);
+                    uint64_t mirror;
+                    if (shift >= 0) {
+                        mirror = (word(j + q) >> r) | (r ? word(j + q + 1) << (64 - r) : 0);
+                    } else {
+                        mirror = (word(j - q) << r) | (r ? word(j - q - 1) >> (64 - r) : 0);
                     }
+
+                    uint64_t keep = ~uint64_t(0);
+                    if ((i + 1) * 64 > at) {
+                        keep = i * 64 >= at ? 0 : (uint64_t(1) << (at % 64)) - 1;
+                    }
+                    cells[i] = (cells[i] | mirror) & keep;
                 }
             }
-
-            return result;
+            width = std::min(width, at);
         }
 
-        Paper fold(const std::pair<int,int>& at) const {
+        void fold_in_place(const std::pair<int,int>& at) {
             auto [x, y] = at;
             if (x == 0) {
-                return hfold(y);
+                hfold_in_place(y);
             } else {
-                return vfold(x);
+                vfold_in_place(x);
             }
         }
 
+        Paper hfold(std::size_t at) const {
+            Paper result = *this;
+            result.hfold_in_place(at);
+            return result;
+        }
+
+        Paper vfold(std::size_t at) const {
+            Paper result = *this;
+            result.vfold_in_place(at);
+            return result;
+        }
+
+        Paper fold(const std::pair<int,int>& at) const {
+            Paper result = *this;
+            result.fold_in_place(at);
+            return result;
+        }
+
         void print() {
             for (std::size_t y = 0; y < height; y++) {
                 for (std::size_t x = 0; x < width; x++) {
@@ -68,30 +138,27 @@ namespace day13 {
         }
     };
 
-    auto parse_paper(const std::string& path) {
-        std::vector<std::pair<int, int>> marks;
+    using Point = std::pair<int64_t, int64_t>;
+    using Command = std::pair<int, int>;
+
+    auto parse_points(const std::string& path) {
+        std::vector<Point> marks;
         auto lines = slurp(path, true);
-        std::size_t width = 0;
-        std::size_t height = 0;
         bool parse_paper = true;
-        std::vector<std::pair<int,int>> commands;
+        std::vector<Command> commands;
         for (const auto& line: lines) {
             if (parse_paper) {
                 if (line.size() > 0) {
                     auto parts = split_char(line, ',');
                     if (parts.size() == 2) {
-                        std::size_t x = to_int(parts[0]);
-                        std::size_t y = to_int(parts[1]);
-                        width = std::max(x, width);
-                        height = std::max(y, height);
-                        marks.push_back(std::make_pair(x, y));
+                        marks.emplace_back(to_u64(parts[0]), to_u64(parts[1]));
                     } else {
                         fail(line);
                     }
                 } else {
                     parse_paper = false;
                 }
-            } else {
+            } else if (!line.empty()) {
                 auto parts = split_char(line, ' ');
                 auto xy = split_char(parts.back(), '=');
                 int v = to_int(xy.back());
@@ -102,6 +169,17 @@ namespace day13 {
                 }
             }
         }
+        return std::make_pair(std::move(marks), std::move(commands));
+    }
+
+    auto parse_paper(const std::string& path) {
+        auto [marks, commands] = parse_points(path);
+        std::size_t width = 0;
+        std::size_t height = 0;
+        for (auto [x, y]: marks) {
+            width = std::max<std::size_t>(x, width);
+            height = std::max<std::size_t>(y, height);
+        }
 
         Paper result(width+1, height+1);
         for (auto [x, y]: marks) {
@@ -110,8 +188,98 @@ namespace day13 {
         return std::make_pair(result, std::move(commands));
     }
 
-    Paper fold(const Paper& p, std::vector<std::pair<int,int>> commands) {
-        return std::accumulate(commands.begin(), commands.end(), p, std::mem_fn(&Paper::fold));
+    // The folds along one axis, applied to a coordinate all at once. A coordinate on a fold line,
+    // or folded past the edge, is dropped as the dense folds do.
+    struct AxisFolds {
+        std::vector<int64_t> lines;
+
+        std::optional<int64_t> apply(int64_t v) const {
+            for (int64_t at: lines) {
+                if (v == at || v > 2 * at) {
+                    return std::nullopt;
+                }
+                if (v > at) {
+                    v = 2 * at - v;
+                }
+            }
+            return v;
+        }
+    };
+
+    // Only the marked points, so the cost of folding follows the marks rather than the area.
+    struct SparsePaper {
+        std::vector<Point> points; // sorted and unique
+
+        explicit SparsePaper(std::vector<Point> p) : points(std::move(p)) {
+            dedup();
+        }
+
+        // sorts a slice per thread, then merges the sorted slices pairwise
+        void dedup() {
+            std::size_t chunk_count = std::min(thread_count(), std::max<std::size_t>(points.size() / 4096, 1));
+            std::vector<std::size_t> bounds(chunk_count + 1);
+            parallel_chunks(points.size(), chunk_count, [&](std::size_t c, std::size_t begin, std::size_t end) {
+                std::sort(points.begin() + begin, points.begin() + end);
+                bounds[c + 1] = end;
+            });
+            for (std::size_t width = 1; width < chunk_count; width *= 2) {
+                for (std::size_t c = 0; c + width < chunk_count; c += 2 * width) {
+                    std::size_t last = bounds[std::min(c + 2 * width, chunk_count)];
+                    std::inplace_merge(points.begin() + bounds[c], points.begin() + bounds[c + width], points.begin() + last);
+                }
+            }
+            points.erase(std::unique(points.begin(), points.end()), points.end());
+        }
+
+        std::size_t mark_count() const {
+            return points.size();
+        }
+
+        // splits the commands by axis and moves every point through both axes' folds in one pass
+        SparsePaper fold(const std::vector<Command>& commands) const {
+            AxisFolds xs;
+            AxisFolds ys;
+            for (auto [x, y]: commands) {
+                if (x == 0) {
+                    ys.lines.push_back(y);
+                } else {
+                    xs.lines.push_back(x);
+                }
+            }
+
+            constexpr Point dropped{-1, -1};
+            std::vector<Point> result(points.size());
+            parallel_for(points.size(), [&](std::size_t i) {
+                auto x = xs.apply(points[i].first);
+                auto y = ys.apply(points[i].second);
+                result[i] = x && y ? Point{*x, *y} : dropped;
+            });
+            result.erase(std::remove(result.begin(), result.end(), dropped), result.end());
+
+            return SparsePaper(std::move(result));
+        }
+
+        Paper to_paper() const {
+            int64_t width = 0;
+            int64_t height = 0;
+            for (auto [x, y]: points) {
+                width = std::max(x, width);
+                height = std::max(y, height);
+            }
+            Paper result(width+1, height+1);
+            for (auto [x, y]: points) {
+                result.mark(x, y);
+            }
+            return result;
+        }
+    };
+
+    Paper fold(const Paper& p, const std::vector<std::pair<int,int>>& commands) {
+        Paper result = p;
+        for (const auto& c: commands) {
+            result.fold_in_place(c);
+        }
+        return result;
     }
 
 }
@@ -132,3 +300,76 @@ TEST_CASE("day13p2", "[aoc2021]") {
     auto [p, commands] = day13::parse_paper("day13.txt");
     fold(p, commands).print();
 }
+
+TEST_CASE("day13 sparse", "[aoc2021]") {
+    auto [points, commands] = day13::parse_points("day13.txt");
+    day13::SparsePaper sparse(points);
+
+    REQUIRE(sparse.fold({commands.front()}).mark_count() == 661);
+
+    auto [p, dense_commands] = day13::parse_paper("day13.txt");
+    auto dense = fold(p, dense_commands);
+    auto folded = sparse.fold(commands).to_paper();
+    REQUIRE(folded.mark_count() == dense.mark_count());
+    for (std::size_t y = 0; y < dense.height; y++) {
+        for (std::size_t x = 0; x < dense.width; x++) {
+            REQUIRE(dense.marked(x, y) == (x < folded.width && y < folded.height && folded.marked(x, y)));
+        }
+    }
+
+    // a million points on a sheet a billion wide, folded in half along x down to one column
+    std::vector<day13::Point> wide;
+    for (int64_t i = 0; i < 1000000; i++) {
+        wide.emplace_back(i * 999 + 1, i % 7);
+    }
+    std::vector<day13::Command> halves;
+    for (int64_t w = int64_t(1) << 30; w > 2; w /= 2) {
+        halves.emplace_back(w / 2 - 1, 0);
+    }
+    auto tiny = day13::SparsePaper(wide).fold(halves);
+    REQUIRE(tiny.mark_count() == 7);
+    for (int64_t y = 0; y < 7; y++) {
+        REQUIRE(tiny.points[y] == day13::Point{0, y});
+    }
+}
+
+TEST_CASE("day13 packed", "[aoc2021]") {
+    // compare against folding cell by cell, over widths around word boundaries
+    for (std::size_t w: {5, 63, 64, 65, 129, 200}) {
+        std::size_t h = 7;
+        day13::Paper p(w, h);
+        std::vector<std::vector<bool>> cells(h, std::vector<bool>(w));
+        for (std::size_t y = 0; y < h; y++) {
+            for (std::size_t x = 0; x < w; x++) {
+                if ((x * 7 + y * 13) % 5 == 0) {
+                    p.mark(x, y);
+                    cells[y][x] = true;
+                }
+            }
+        }
+
+        for (std::size_t at: {w / 2, w / 3, w - 1, std::size_t(1)}) {
+            if (at == 0 || at >= w) {
+                continue;
+            }
+            auto folded = p.vfold(at);
+            REQUIRE(folded.width == at);
+            int count = 0;
+            for (std::size_t y = 0; y < h; y++) {
+                for (std::size_t x = 0; x < at; x++) {
+                    bool expected = cells[y][x] || (2 * at - x < w && cells[y][2 * at - x]);
+                    REQUIRE(folded.marked(x, y) == expected);
+                    count += expected;
+                }
+            }
+            REQUIRE(folded.mark_count() == count);
+        }
+
+        auto folded = p.hfold(3);
+        for (std::size_t y = 0; y < 3; y++) {
+            for (std::size_t x = 0; x < w; x++) {
+                REQUIRE(folded.marked(x, y) == (cells[y][x] || cells[6 - y][x]));
+            }
+        }
+    }
+}
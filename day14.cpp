@@ -1,5 +1,14 @@
 #include "util.h"
 #include <compare>
+#include <random>
+#include <thread>
+#include <memory>
+#include <shared_mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DAY14_HAVE_AVX2 1
+#endif
 
 namespace day14 {
 
@@ -12,22 +21,114 @@ namespace day14 {
         std::strong_ordering operator<=>(const Rule &) const = default;
     };
 
+    // the pairs a single pair has become after some steps, and the letters they start
+    struct Expansion {
+        std::vector<std::pair<uint16_t, uint64_t>> pairs; // (first * 26 + second, count), nonzero only
+        std::array<uint64_t, 26> letters;
+    };
+
+    // Expansions keyed by pair + depth * 26 * 26. Entries are never removed, so references to
+    // them stay valid while other threads insert.
+    struct ExpansionCache {
+        std::shared_mutex mutex;
+        std::unordered_map<uint64_t, std::unique_ptr<const Expansion>> entries;
+    };
+
     struct RuleIndex {
         std::vector<char> buffer;
+        // shared by copies, which have the same rules until one of them adds another
+        std::shared_ptr<ExpansionCache> cache;
 
         RuleIndex(const std::vector<Rule> &rules) : buffer(26 * 26) {
             for (const Rule &r: rules) {
-                add_rule(r);
+                buffer[slot(r)] = r.insert[0];
             }
+            cache = std::make_shared<ExpansionCache>();
+        }
+
+        static std::size_t slot(const Rule &rule) {
+            return (rule.pattern[0] - 'A') * 26 + (rule.pattern[1] - 'A');
         }
 
+        // a new rule invalidates every cached expansion, so this index starts a fresh cache
         void add_rule(const Rule &rule) {
-            buffer[(rule.pattern[0] - 'A') * 26 + (rule.pattern[1] - 'A')] = rule.insert[0];
+            buffer[slot(rule)] = rule.insert[0];
+            cache = std::make_shared<ExpansionCache>();
         }
 
         char lookup(char a, char b) const {
             return buffer[(a - 'A') * 26 + (b - 'A')];
         }
+
+        // Built on first use from the expansions one step shallower when depth is odd, or by
+        // expanding every pair of the half-depth expansion by half the depth again when it is
+        // even, so depth d takes O(log d) levels of entries.
+        const Expansion& expansion(uint16_t pair, uint32_t depth) const {
+            uint64_t key = pair + uint64_t(depth) * 26 * 26;
+            {
+                std::shared_lock lock(cache->mutex);
+                auto it = cache->entries.find(key);
+                if (it != cache->entries.end()) {
+                    return *it->second;
+                }
+            }
+
+            std::array<uint64_t, 26 * 26> counts{};
+            if (depth == 0) {
+                counts[pair] = 1;
+            } else if (depth % 2 == 1) {
+                char a = 'A' + pair / 26;
+                char b = 'A' + pair % 26;
+                char insert = lookup(a, b);
+                std::vector<uint16_t> children{pair};
+                if (insert) {
+                    children = {uint16_t(pair - pair % 26 + (insert - 'A')), uint16_t((insert - 'A') * 26 + pair % 26)};
+                }
+                for (uint16_t c: children) {
+                    for (auto [q, n]: expansion(c, depth - 1).pairs) {
+                        counts[q] += n;
+                    }
+                }
+            } else {
+                for (auto [q, n]: expansion(pair, depth / 2).pairs) {
+                    for (auto [r, m]: expansion(q, depth / 2).pairs) {
+                        counts[r] += n * m;
+                    }
+                }
+            }
+
+            auto result = std::make_unique<Expansion>();
+            result->letters = {};
+            for (uint16_t q = 0; q < counts.size(); q++) {
+                if (counts[q]) {
+                    result->pairs.emplace_back(q, counts[q]);
+                    result->letters[q / 26] += counts[q];
+                }
+            }
+
+            // another thread may have got there first, in which case its entry wins
+            std::unique_lock lock(cache->mutex);
+            return *cache->entries.try_emplace(key, std::move(result)).first->second;
+        }
+
+        // letter counts of a polymer after depth steps, wrapping past 2^64 like iterate2
+        std::array<uint64_t, 26> histogram(const std::string& templ, uint32_t depth) const {
+            std::array<uint64_t, 26> result{};
+            for (std::size_t i = 0; i + 1 < templ.size(); i++) {
+                const auto& e = expansion((templ[i] - 'A') * 26 + (templ[i+1] - 'A'), depth);
+                for (int l = 0; l < 26; l++) {
+                    result[l] += e.letters[l];
+                }
+            }
+            result[templ.back() - 'A']++;
+            return result;
+        }
+
+        std::vector<std::array<uint64_t, 26>> histograms(const std::vector<std::string>& templates, uint32_t depth) const {
+            std::vector<std::array<uint64_t, 26>> result(templates.size());
+            parallel_for(templates.size(), [&](std::size_t i) { result[i] = histogram(templates[i], depth); });
+            return result;
+        }
     };
 
     struct Input {
@@ -51,77 +152,528 @@ namespace day14 {
         return Input{t, RuleIndex(rules)};
     }
 
-    std::vector<std::string_view> sliding(const std::string &s) {
-        auto it = s.begin();
-        std::vector<std::string_view> result;
+    // Counts modulo Mod, for step counts whose exact totals fit no integer type
+    template <uint64_t Mod = 1000000007>
+    struct Modular {
+        uint64_t value = 0;
 
-        result.reserve(s.size());
+        Modular() = default;
+        Modular(uint64_t v) : value(v % Mod) {}
 
-        do {
-            result.emplace_back(it, it + 2);
-            ++it;
-        } while ((it + 2 - 1) != s.end());
+        Modular& operator+=(Modular o) {
+            value = (value + o.value) % Mod;
+            return *this;
+        }
+
+        friend Modular operator+(Modular a, Modular b) {
+            return a += b;
+        }
+
+        friend Modular operator*(Modular a, Modular b) {
+            return Modular(uint64_t((unsigned __int128)a.value * b.value % Mod));
+        }
+
+        bool operator==(const Modular&) const = default;
+    };
+
+    // The letters that actually occur, numbered densely so a pair is a small array index.
+    struct Alphabet {
+        std::array<int8_t, 26> index;
+        std::string letters;
+
+        Alphabet(const std::string& templ, const RuleIndex& rules) {
+            index.fill(-1);
+            for (char c: templ) {
+                add(c);
+            }
+            for (std::size_t i = 0; i < rules.buffer.size(); i++) {
+                if (rules.buffer[i]) {
+                    add('A' + i / 26);
+                    add('A' + i % 26);
+                    add(rules.buffer[i]);
+                }
+            }
+        }
+
+        void add(char c) {
+            if (index[c - 'A'] < 0) {
+                index[c - 'A'] = letters.size();
+                letters.push_back(c);
+            }
+        }
+
+        std::size_t size() const {
+            return letters.size();
+        }
+
+        int operator()(char c) const {
+            return index[c - 'A'];
+        }
+    };
+
+    // Pair counts live in a dense vector indexed by first * n + second over the compacted
+    // alphabet. A step sends each pair's count to the two pairs its insertion makes, so the
+    // transition matrix has at most two entries per column and is stored as that pair list.
+    // Long runs raise the matrix to a power by squaring instead of stepping.
+    template <typename T>
+    struct PolymerEngine {
+        using Matrix = std::vector<T>; // pair_count x pair_count, row major, [to][from]
+
+        static constexpr uint16_t no_pair = std::numeric_limits<uint16_t>::max();
+
+        Alphabet alphabet;
+        std::size_t pair_count;
+        std::vector<std::array<uint16_t, 2>> children; // no_pair where a pair has no rule
+        std::vector<T> initial;
+        int last;                                        // the final letter, never the first of a pair
+
+        PolymerEngine(const std::string& templ, const RuleIndex& rules)
+                : alphabet(templ, rules), pair_count(alphabet.size() * alphabet.size()),
+                  children(pair_count), initial(pair_count), last(alphabet(templ.back())) {
+            std::size_t n = alphabet.size();
+            for (std::size_t a = 0; a < n; a++) {
+                for (std::size_t b = 0; b < n; b++) {
+                    char insert = rules.lookup(alphabet.letters[a], alphabet.letters[b]);
+                    if (insert) {
+                        children[a * n + b] = {uint16_t(a * n + alphabet(insert)), uint16_t(alphabet(insert) * n + b)};
+                    } else {
+                        children[a * n + b] = {uint16_t(a * n + b), no_pair};
+                    }
+                }
+            }
+            for (std::size_t i = 0; i + 1 < templ.size(); i++) {
+                initial[pair(templ[i], templ[i+1])] += T{1};
+            }
+        }
+
+        std::size_t pair(char a, char b) const {
+            return alphabet(a) * alphabet.size() + alphabet(b);
+        }
+
+        void step(const std::vector<T>& counts, std::vector<T>& next) const {
+            std::fill(next.begin(), next.end(), T{});
+            for (std::size_t p = 0; p < pair_count; p++) {
+                for (uint16_t c: children[p]) {
+                    if (c != no_pair) {
+                        next[c] += counts[p];
+                    }
+                }
+            }
+        }
+
+        std::vector<T> iterate(std::vector<T> counts, uint64_t steps) const {
+            std::vector<T> next(pair_count);
+            while (steps--) {
+                step(counts, next);
+                counts.swap(next);
+            }
+            return counts;
+        }
+
+        Matrix transition() const {
+            Matrix result(pair_count * pair_count);
+            for (std::size_t p = 0; p < pair_count; p++) {
+                for (uint16_t c: children[p]) {
+                    if (c != no_pair) {
+                        result[c * pair_count + p] += T{1};
+                    }
+                }
+            }
+            return result;
+        }
+
+        Matrix multiply(const Matrix& a, const Matrix& b) const {
+            Matrix result(pair_count * pair_count);
+            for (std::size_t i = 0; i < pair_count; i++) {
+                for (std::size_t k = 0; k < pair_count; k++) {
+                    T aik = a[i * pair_count + k];
+                    if (aik == T{}) {
+                        continue;
+                    }
+                    for (std::size_t j = 0; j < pair_count; j++) {
+                        result[i * pair_count + j] += aik * b[k * pair_count + j];
+                    }
+                }
+            }
+            return result;
+        }
+
+        std::vector<T> apply(const Matrix& m, const std::vector<T>& counts) const {
+            std::vector<T> result(pair_count);
+            for (std::size_t i = 0; i < pair_count; i++) {
+                for (std::size_t j = 0; j < pair_count; j++) {
+                    result[i] += m[i * pair_count + j] * counts[j];
+                }
+            }
+            return result;
+        }
+
+        // applies M^(2^i) for every set bit i of steps, squaring M as it goes
+        std::vector<T> power(std::vector<T> counts, uint64_t steps) const {
+            Matrix m = transition();
+            while (steps) {
+                if (steps & 1) {
+                    counts = apply(m, counts);
+                }
+                steps >>= 1;
+                if (steps) {
+                    m = multiply(m, m);
+                }
+            }
+            return counts;
+        }
+
+        // stepping costs pair_count per step, squaring pair_count^3 per bit
+        std::vector<T> pairs_after(uint64_t steps) const {
+            if (steps <= pair_count * pair_count) {
+                return iterate(initial, steps);
+            }
+            return power(initial, steps);
+        }
+
+        // every letter but the last starts exactly one pair
+        std::vector<T> letters(const std::vector<T>& pairs) const {
+            std::size_t n = alphabet.size();
+            std::vector<T> result(n);
+            for (std::size_t p = 0; p < pair_count; p++) {
+                result[p / n] += pairs[p];
+            }
+            result[last] += T{1};
+            return result;
+        }
+
+        std::vector<T> letters_after(uint64_t steps) const {
+            return letters(pairs_after(steps));
+        }
+    };
+
+    // Finds characters of the polymer after a number of steps without building it. Every pair
+    // of the template expands into a binary tree whose leaves are the characters it produces
+    // (all but its second letter), and lengths[d][p] counts the leaves of pair p after d steps,
+    // so position k is found by descending one tree level per step.
+    struct PolymerIndex {
+        static constexpr uint64_t saturated = std::numeric_limits<uint64_t>::max();
+
+        PolymerEngine<uint64_t> engine;
+        std::vector<uint16_t> roots; // the template's pairs
+        uint32_t depth;
+        // Rows up to the depth where every length either repeats or grows by the same amount as
+        // the step before, after which each keeps that growth forever (the differences are then
+        // a fixed point of the same linear step). Lengths stop at saturated rather than wrap.
+        // Rules that make lengths grow faster than linearly but slower than exponentially keep a
+        // row per depth, so memory and build time are O(depth * pairs) for them.
+        std::vector<std::vector<uint64_t>> lengths;
+        std::vector<uint64_t> growth; // per pair, added to the last row for every further depth
+
+        PolymerIndex(const std::string& templ, const RuleIndex& rules, uint32_t steps)
+                : engine(templ, rules), depth(steps) {
+            for (std::size_t i = 0; i + 1 < templ.size(); i++) {
+                roots.push_back(engine.pair(templ[i], templ[i+1]));
+            }
+
+            lengths.emplace_back(engine.pair_count, 1);
+            growth.assign(engine.pair_count, 0);
+            while (lengths.size() <= depth) {
+                const auto& prev = lengths.back();
+                std::vector<uint64_t> row(engine.pair_count);
+                std::vector<uint64_t> step(engine.pair_count);
+                for (std::size_t p = 0; p < engine.pair_count; p++) {
+                    for (uint16_t c: engine.children[p]) {
+                        if (c != engine.no_pair && __builtin_add_overflow(row[p], prev[c], &row[p])) {
+                            row[p] = saturated;
+                        }
+                    }
+                    // a length that has just saturated grew by an unknown amount, which matches
+                    // no real step
+                    if (row[p] != saturated) {
+                        step[p] = row[p] - prev[p];
+                    } else if (prev[p] != saturated) {
+                        step[p] = saturated;
+                    }
+                }
+
+                if (row == prev) {
+                    growth.assign(engine.pair_count, 0);
+                    break;
+                }
+                bool linear = lengths.size() > 1 && step == growth;
+                lengths.push_back(std::move(row));
+                growth = std::move(step);
+                if (linear) {
+                    break;
+                }
+            }
+        }
+
+        uint64_t length(uint16_t pair, uint32_t d) const {
+            if (d < lengths.size()) {
+                return lengths[d][pair];
+            }
+            uint64_t result;
+            if (__builtin_mul_overflow(uint64_t(d - (lengths.size() - 1)), growth[pair], &result) ||
+                __builtin_add_overflow(result, lengths.back()[pair], &result)) {
+                return saturated;
+            }
+            return result;
+        }
+
+        // the polymer length, or saturated if it does not fit
+        uint64_t size() const {
+            uint64_t total = 1;
+            for (uint16_t r: roots) {
+                if (__builtin_add_overflow(total, length(r, depth), &total)) {
+                    return saturated;
+                }
+            }
+            return total;
+        }
+
+        char first_letter(uint16_t pair) const {
+            return engine.alphabet.letters[pair / engine.alphabet.size()];
+        }
+
+        char last_letter() const {
+            return engine.alphabet.letters[engine.last];
+        }
+
+        char at(uint64_t k) const;
+
+        std::string substr(uint64_t pos, uint64_t count) const;
+    };
+
+    // Walks the polymer from a position, one character per call to next(). The stack holds the
+    // subtrees to the right of the current leaf, nearest last, so a step costs amortized O(1).
+    struct PolymerCursor {
+        const PolymerIndex& index;
+        std::size_t next_root;                                 // roots.size() while the final letter is to come
+        std::vector<std::pair<uint16_t, uint32_t>> pending;    // (pair, depth)
+        char current;
+
+        PolymerCursor(const PolymerIndex& idx, uint64_t k) : index(idx), next_root(0), current(0) {
+            for (; next_root < index.roots.size(); next_root++) {
+                uint64_t l = index.length(index.roots[next_root], index.depth);
+                if (k < l) {
+                    descend(index.roots[next_root++], index.depth, k);
+                    return;
+                }
+                k -= l;
+            }
+            if (k != 0) {
+                fail(std::format("position {} past the end of the polymer", k));
+            }
+            next_root++;
+            current = index.last_letter();
+        }
+
+        // descends to leaf k of (pair, d), remembering the right subtrees passed on the way. A
+        // pair without a rule is the same pair at every depth, so the descent ends there.
+        void descend(uint16_t pair, uint32_t d, uint64_t k) {
+            for (; d > 0; d--) {
+                auto [left, right] = index.engine.children[pair];
+                if (right == index.engine.no_pair) {
+                    break;
+                }
+                uint64_t l = index.length(left, d - 1);
+                if (k < l) {
+                    pending.emplace_back(right, d - 1);
+                    pair = left;
+                } else {
+                    k -= l;
+                    pair = right;
+                }
+            }
+            current = index.first_letter(pair);
+        }
+
+        char value() const {
+            return current;
+        }
+
+        // advances to the next character, false past the end of the polymer
+        bool next() {
+            if (!pending.empty()) {
+                auto [pair, d] = pending.back();
+                pending.pop_back();
+                descend(pair, d, 0);
+                return true;
+            }
+            if (next_root < index.roots.size()) {
+                descend(index.roots[next_root++], index.depth, 0);
+                return true;
+            }
+            if (next_root == index.roots.size()) {
+                next_root++;
+                current = index.last_letter();
+                return true;
+            }
+            return false;
+        }
+    };
 
+    char PolymerIndex::at(uint64_t k) const {
+        return PolymerCursor(*this, k).value();
+    }
+
+    // count characters from pos, or fewer if the polymer ends first
+    std::string PolymerIndex::substr(uint64_t pos, uint64_t count) const {
+        std::string result;
+        if (count == 0) {
+            return result;
+        }
+        PolymerCursor cursor(*this, pos);
+        do {
+            result.push_back(cursor.value());
+        } while (result.size() < count && cursor.next());
         return result;
     }
 
-    std::string iterate(const std::string &s, const RuleIndex &rules) {
-        std::string result(s.size() * 2 + 1, 0);
-        std::size_t idx = 0;
+    // most common letter count less the least common, over the letters that occur
+    auto spread(const auto& letters) {
+        using T = std::ranges::range_value_t<decltype(letters)>;
+        T max = std::numeric_limits<T>::min();
+        T min = std::numeric_limits<T>::max();
+        for (T v: letters) {
+            if (v > 0) {
+                max = std::max(max, v);
+                min = std::min(min, v);
+            }
+        }
+        return max - min;
+    }
+
+    std::vector<std::string_view> sliding(const std::string &s) {
         auto it = s.begin();
+        std::vector<std::string_view> result;
+
+        result.reserve(s.size());
 
         do {
-            result[idx++] = *it;
-            result[idx++] = rules.lookup(*it, *(it + 1));
+            result.emplace_back(it, it + 2);
             ++it;
         } while ((it + 2 - 1) != s.end());
 
-        result[idx++] = s.back();
-
-        result.resize(idx);
-
         return result;
     }
 
-    using PairsCounter = std::map<std::pair<char,char>, std::size_t>;
+    // One insertion step over a whole string, written to a caller's buffer. Every source
+    // character is followed by the character inserted after it, so pair i lands at 2i and 2i+1
+    // and chunks of pairs can be expanded independently. A pair without a rule inserts nothing,
+    // as in PolymerEngine, so chunks that met one are compacted afterwards.
+    struct PairExpander {
+        // inserted character per pair, 32 bits wide so a gather reads one entry per lane
+        std::array<int32_t, 26 * 26> table;
 
-    std::size_t iterate2(const std::string &s, const RuleIndex &rules, int steps) {
-        PairsCounter current_counts{};
-        std::map<char, std::size_t> letter_counts{};
-
-        for (auto p: sliding(s)) {
-            current_counts[std::make_pair(p[0], p[1])]++;
-        }
-        for (char c: s) {
-            letter_counts[c]++;
+        explicit PairExpander(const RuleIndex& rules) {
+            std::copy(rules.buffer.begin(), rules.buffer.end(), table.begin());
         }
 
-        for (int step = 0; step < steps; step++) {
-            PairsCounter new_counts{};
+        char insert(char a, char b) const {
+            return table[(a - 'A') * 26 + (b - 'A')];
+        }
 
-            for (auto [p, cnt]: current_counts) {
-                char add = rules.lookup(p.first, p.second);
-                auto p1 = std::make_pair(p.first, add);
-                auto p2 = std::make_pair(add, p.second);
-                new_counts[p1] += cnt;
-                new_counts[p2] += cnt;
-                letter_counts[add] += cnt;
+        // pairs [lo, hi) of src, leaving '\0' after a pair without a rule; true if there was one
+        bool expand_range(const char* src, std::size_t lo, std::size_t hi, char* out) const {
+            bool missing = false;
+            for (std::size_t i = lo; i < hi; i++) {
+                out[2 * i] = src[i];
+                out[2 * i + 1] = insert(src[i], src[i+1]);
+                missing |= out[2 * i + 1] == 0;
             }
+            return missing;
+        }
 
-            current_counts = std::move(new_counts);
+#ifdef DAY14_HAVE_AVX2
+        __attribute__((target("avx2")))
+        static __m256i widen8(const char* p) {
+            return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
         }
 
-        std::size_t max = std::numeric_limits<std::size_t>::min();
-        std::size_t min = std::numeric_limits<std::size_t>::max();
+        // inserts for the 8 pairs starting at p
+        __attribute__((target("avx2")))
+        static __m256i gather8(const int32_t* table, const char* p) {
+            __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(widen8(p), _mm256_set1_epi32(26)), widen8(p + 1));
+            return _mm256_i32gather_epi32(table, _mm256_sub_epi32(index, _mm256_set1_epi32('A' * 27)), 4);
+        }
 
-        for (auto [k, v]: letter_counts) {
-            if (v > 0) {
-                max = std::max(max, v);
-                min = std::min(min, v);
+        // 16 pairs a round: two gathers of 8 inserts, narrowed to bytes and interleaved with
+        // the source characters
+        __attribute__((target("avx2")))
+        bool expand_range_avx2(const char* src, std::size_t lo, std::size_t hi, char* out) const {
+            __m128i missing = _mm_setzero_si128();
+            std::size_t i = lo;
+            for (; i + 16 <= hi; i += 16) {
+                __m256i words = _mm256_packus_epi32(gather8(table.data(), src + i), gather8(table.data(), src + i + 8));
+                words = _mm256_permute4x64_epi64(words, _MM_SHUFFLE(3, 1, 2, 0));
+                __m128i inserts = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+                missing = _mm_or_si128(missing, _mm_cmpeq_epi8(inserts, _mm_setzero_si128()));
+
+                __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), _mm_unpacklo_epi8(chars, inserts));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 16), _mm_unpackhi_epi8(chars, inserts));
             }
+            return expand_range(src, i, hi, out) || _mm_movemask_epi8(missing) != 0;
+        }
+#endif
+
+        // Writes up to 2 * src.size() - 1 characters to out, the pairs split into chunks across
+        // threads, and returns how many. Each chunk drops its own missing inserts, and the chunks
+        // are then moved together, which only happens when some pair had no rule.
+        std::size_t expand(std::string_view src, char* out, std::size_t chunk_count = thread_count()) const {
+            if (src.empty()) {
+                return 0;
+            }
+            std::size_t pairs = src.size() - 1;
+            chunk_count = std::clamp<std::size_t>(chunk_count, 1, std::max<std::size_t>(pairs / 4096, 1));
+
+            std::vector<std::pair<std::size_t, std::size_t>> written(chunk_count); // (start, length)
+            parallel_chunks(pairs, chunk_count, [&](std::size_t c, std::size_t lo, std::size_t hi) {
+                bool missing;
+#ifdef DAY14_HAVE_AVX2
+                if (__builtin_cpu_supports("avx2")) {
+                    missing = expand_range_avx2(src.data(), lo, hi, out);
+                } else
+#endif
+                {
+                    missing = expand_range(src.data(), lo, hi, out);
+                }
+                char* end = missing ? std::remove(out + 2 * lo, out + 2 * hi, '\0') : out + 2 * hi;
+                written[c] = {2 * lo, end - (out + 2 * lo)};
+            });
+
+            std::size_t size = 0;
+            for (auto [start, length]: written) {
+                if (start != size) {
+                    std::memmove(out + size, out + start, length);
+                }
+                size += length;
+            }
+            out[size] = src.back();
+            return size + 1;
         }
 
-        return max - min;
+        // expands block_pairs pairs at a time through one reused buffer
+        void expand(std::string_view src, std::ostream& os, std::size_t block_pairs = 1 << 20) const {
+            std::string buffer;
+            while (src.size() > 1) {
+                std::size_t n = std::min(block_pairs, src.size() - 1);
+                buffer.resize(2 * n + 1);
+                std::size_t size = expand(src.substr(0, n + 1), buffer.data());
+                os.write(buffer.data(), size - 1); // the last character starts the next block
+                src.remove_prefix(n);
+            }
+            os.write(src.data(), src.size());
+        }
+    };
+
+    std::string iterate(const std::string &s, const RuleIndex &rules) {
+        std::string result(s.empty() ? 0 : 2 * s.size() - 1, 0);
+        result.resize(PairExpander(rules).expand(s, result.data()));
+        return result;
+    }
+
+    std::size_t iterate2(const std::string &s, const RuleIndex &rules, int steps) {
+        PolymerEngine<uint64_t> engine(s, rules);
+        return spread(engine.letters_after(steps));
     }
 
     std::array<std::size_t,26> frequencies(const std::string& s) {
@@ -210,4 +762,185 @@ TEST_CASE("day14", "[aoc2021]") {
     score = iterate2(input.templ, input.rules, 40);
 
     REQUIRE(score == 2827627697643);
-}
\ No newline at end of file
+}
+
+TEST_CASE("day14 engine", "[aoc2021]") {
+    auto input = day14::parse_input("day14.txt");
+    day14::PolymerEngine<unsigned __int128> exact(input.templ, input.rules);
+
+    // matrix powers agree with stepping, and the letters add up to the polymer length
+    for (uint64_t steps: {0, 1, 10, 40, 100}) {
+        auto letters = exact.letters(exact.power(exact.initial, steps));
+        REQUIRE(letters == exact.letters(exact.iterate(exact.initial, steps)));
+
+        unsigned __int128 length = ((unsigned __int128)(input.templ.size() - 1) << steps) + 1;
+        REQUIRE(std::accumulate(letters.begin(), letters.end(), (unsigned __int128)0) == length);
+    }
+    REQUIRE(day14::spread(exact.letters_after(40)) == 2827627697643);
+
+    // modular counts match the exact ones reduced, and compose across 10^12 steps
+    using Mod = day14::Modular<>;
+    day14::PolymerEngine<Mod> modular(input.templ, input.rules);
+    auto reduced = modular.letters_after(100);
+    auto letters = exact.letters_after(100);
+    for (std::size_t i = 0; i < letters.size(); i++) {
+        REQUIRE(reduced[i] == Mod(uint64_t(letters[i] % 1000000007)));
+    }
+
+    uint64_t trillion = 1000000000000;
+    auto direct = modular.power(modular.initial, trillion);
+    auto halves = modular.power(modular.power(modular.initial, trillion / 2), trillion / 2);
+    REQUIRE(direct == halves);
+    REQUIRE(modular.power(direct, 3) == modular.iterate(direct, 3));
+}
+
+TEST_CASE("day14 index", "[aoc2021]") {
+    auto input = day14::parse_input("day14example.txt");
+
+    std::string t = input.templ;
+    for (uint32_t steps = 0; steps <= 12; steps++) {
+        day14::PolymerIndex index(input.templ, input.rules, steps);
+        REQUIRE(index.size() == t.size());
+        for (uint64_t k: {uint64_t(0), uint64_t(t.size() / 3), uint64_t(t.size() - 1)}) {
+            REQUIRE(index.at(k) == t[k]);
+        }
+        REQUIRE(index.substr(0, t.size()) == t);
+        REQUIRE(index.substr(t.size() / 2, 100) == t.substr(t.size() / 2, 100));
+        t = day14::iterate(t, input.rules);
+    }
+
+    // lengths that grow linearly keep a few rows, however deep
+    day14::PolymerIndex linear("AB", day14::RuleIndex(std::vector<day14::Rule>{{"AB", "A"}}), 2000000);
+    REQUIRE(linear.lengths.size() <= 4);
+    REQUIRE(linear.size() == 2000002);
+    REQUIRE(linear.at(0) == 'A');
+    REQUIRE(linear.at(1999999) == 'A');
+    REQUIRE(linear.at(2000001) == 'B');
+    REQUIRE(linear.substr(2000000, 5) == "AB");
+    // streaming the whole polymer stops at each rule-less AA instead of descending the depth
+    REQUIRE(linear.substr(0, linear.size()) == std::string(2000001, 'A') + "B");
+
+    // 10^18 characters into a polymer too long to count, a slice still agrees with at()
+    day14::PolymerIndex deep(input.templ, input.rules, 100);
+    REQUIRE(deep.size() == day14::PolymerIndex::saturated);
+    uint64_t k = 1000000000000000000;
+    std::string slice = deep.substr(k, 64);
+    for (std::size_t i = 0; i < slice.size(); i++) {
+        REQUIRE(slice[i] == deep.at(k + i));
+    }
+}
+
+TEST_CASE("day14 cache", "[aoc2021]") {
+    auto input = day14::parse_input("day14.txt");
+
+    REQUIRE(day14::spread(input.rules.histogram(input.templ, 10)) == 2509);
+    REQUIRE(day14::spread(input.rules.histogram(input.templ, 40)) == 2827627697643);
+
+    // every window of the template as its own polymer, answered concurrently at several depths
+    std::vector<std::string> templates;
+    for (std::size_t len = 2; len <= input.templ.size(); len++) {
+        for (std::size_t i = 0; i + len <= input.templ.size(); i++) {
+            templates.push_back(input.templ.substr(i, len));
+        }
+    }
+
+    // copies share a cache until one of them changes its rules
+    day14::RuleIndex rules = input.rules;
+    REQUIRE(rules.cache == input.rules.cache);
+    REQUIRE(rules.histogram("NN", 1)['K' - 'A'] == 1);
+    rules.add_rule({"NN", "B"});
+    REQUIRE(rules.cache != input.rules.cache);
+    REQUIRE(rules.histogram("NN", 1)['B' - 'A'] == 1);
+    REQUIRE(input.rules.histogram("NN", 1)['B' - 'A'] == 0);
+
+    for (uint32_t depth: {0, 1, 7, 23, 40, 41}) {
+        auto histograms = input.rules.histograms(templates, depth);
+        for (std::size_t i = 0; i < templates.size(); i++) {
+            day14::PolymerEngine<uint64_t> engine(templates[i], input.rules);
+            auto letters = engine.letters_after(depth);
+            for (std::size_t l = 0; l < letters.size(); l++) {
+                REQUIRE(histograms[i][engine.alphabet.letters[l] - 'A'] == letters[l]);
+            }
+        }
+    }
+}
+
+TEST_CASE("day14 expander", "[aoc2021]") {
+    auto input = day14::parse_input("day14.txt");
+    day14::PairExpander expander(input.rules);
+    std::string letters = "BCFHKNOPSV";
+
+    std::mt19937 rng(14);
+    for (std::size_t size: {1, 2, 16, 17, 33, 1000, 100000}) {
+        std::string src(size, 0);
+        for (char& c: src) {
+            c = letters[rng() % letters.size()];
+        }
+
+        std::string expected(2 * size - 1, 0);
+        expander.expand_range(src.data(), 0, size - 1, expected.data());
+        expected.back() = src.back();
+
+        for (std::size_t chunks: {1, 3, 8}) {
+            std::string out(2 * size - 1, 0);
+            expander.expand(src, out.data(), chunks);
+            REQUIRE(out == expected);
+        }
+
+        std::ostringstream os;
+        expander.expand(src, os, 37);
+        REQUIRE(os.str() == expected);
+    }
+
+    // pairs without a rule insert nothing, matching the polymer the index walks
+    day14::RuleIndex partial(std::vector<day14::Rule>{{"AB", "A"}, {"BA", "C"}, {"CC", "B"}});
+    std::string t = "ABCAB";
+    for (uint32_t steps = 1; steps <= 8; steps++) {
+        t = day14::iterate(t, partial);
+        day14::PolymerIndex index("ABCAB", partial, steps);
+        REQUIRE(t.find('\0') == std::string::npos);
+        REQUIRE(index.substr(0, index.size()) == t);
+    }
+
+    day14::PairExpander sparse(partial);
+    std::string src(100000, 0);
+    for (char& c: src) {
+        c = "ABC"[rng() % 3];
+    }
+    std::string expected;
+    for (std::size_t i = 0; i + 1 < src.size(); i++) {
+        expected.push_back(src[i]);
+        if (char c = partial.lookup(src[i], src[i+1])) {
+            expected.push_back(c);
+        }
+    }
+    expected.push_back(src.back());
+    for (std::size_t chunks: {1, 3, 8}) {
+        std::string out(2 * src.size() - 1, 0);
+        out.resize(sparse.expand(src, out.data(), chunks));
+        REQUIRE(out == expected);
+    }
+    std::ostringstream os;
+    sparse.expand(src, os, 37);
+    REQUIRE(os.str() == expected);
+}
+
+TEST_CASE("day14 benchmark", "[.][benchmark]") {
+    auto input = day14::parse_input("day14.txt");
+    std::string t = input.templ;
+    for (int i = 0; i < 20; i++) {
+        t = day14::iterate(t, input.rules);
+    }
+    day14::PairExpander expander(input.rules);
+    std::string out(2 * t.size() - 1, 0);
+
+    BENCHMARK("expand_range") {
+        expander.expand_range(t.data(), 0, t.size() - 1, out.data());
+        return out[1];
+    };
+
+    BENCHMARK("expand") {
+        expander.expand(t, out.data());
+        return out[1];
+    };
+}
@@ -3,31 +3,92 @@
 
 // day 6
 
-TEST_CASE("day6", "[aoc2021]") {
-    auto input = split_char(slurp("day6.txt")[0], ',');
-    auto ints = input | std::views::transform(to_u64);
-    int days = 256;
+namespace day6 {
+    // Cycle is the timer a parent resets to after spawning, Newborn is the timer a new fish starts with.
+    template <std::size_t Cycle = 6, std::size_t Newborn = 8>
+    using Histogram = std::array<uint64_t, std::max(Cycle, Newborn) + 1>;
+
+    template <std::size_t Cycle = 6, std::size_t Newborn = 8>
+    constexpr void step(Histogram<Cycle, Newborn>& counts) {
+        uint64_t new_fish = counts[0];
+        for (std::size_t i = 0; i + 1 < counts.size(); i++) {
+            counts[i] = counts[i+1];
+        }
+        counts.back() = 0;
+        counts[Cycle] += new_fish;
+        counts[Newborn] += new_fish;
+    }
+
+    // table[t] is the number of fish a single fish with timer t has become after Days days
+    // (itself included). Built backwards over the day count so it costs O(Days * timers).
+    template <std::size_t Days, std::size_t Cycle = 6, std::size_t Newborn = 8>
+    constexpr Histogram<Cycle, Newborn> make_table() {
+        Histogram<Cycle, Newborn> table{};
+        table.fill(1);
 
-    std::array<uint64_t ,9> counts{};
+        for (std::size_t d = 0; d < Days; d++) {
+            Histogram<Cycle, Newborn> next{};
+            next[0] = table[Cycle] + table[Newborn];
+            for (std::size_t t = 1; t < table.size(); t++) {
+                next[t] = table[t-1];
+            }
+            table = next;
+        }
 
-    for (int idx: ints) {
-        counts[idx]++;
+        return table;
     }
 
-    for (int d = 0; d < days; d++) {
-        uint64_t new_fish = counts[0];
-        for (int i = 0; i < 8; i++) {
-            counts[i] = counts[i+1];
+    template <std::size_t Days, std::size_t Cycle = 6, std::size_t Newborn = 8>
+    struct LanternfishTable {
+        static constexpr Histogram<Cycle, Newborn> table = make_table<Days, Cycle, Newborn>();
+
+        static constexpr uint64_t population(const Histogram<Cycle, Newborn>& counts) {
+            uint64_t total = 0;
+            for (std::size_t t = 0; t < counts.size(); t++) {
+                total += table[t] * counts[t];
+            }
+            return total;
+        }
+    };
+
+    template <std::size_t Cycle = 6, std::size_t Newborn = 8>
+    Histogram<Cycle, Newborn> parse_histogram(const std::string& path) {
+        Histogram<Cycle, Newborn> counts{};
+        for (const auto& s: split_char(slurp(path)[0], ',')) {
+            counts[to_u64(s)]++;
         }
-        counts[6] += new_fish;
-        counts[8] = new_fish;
+        return counts;
     }
 
-    uint64_t totalfish = 0;
-    for (uint64_t f: counts) {
-        totalfish += f;
+    template <std::size_t Cycle = 6, std::size_t Newborn = 8>
+    uint64_t simulate(Histogram<Cycle, Newborn> counts, int days) {
+        while (days--) {
+            step<Cycle, Newborn>(counts);
+        }
+        return std::accumulate(counts.begin(), counts.end(), uint64_t{0});
     }
+
+    // example input 3,4,3,1,2
+    constexpr Histogram<> example{0, 1, 1, 2, 1, 0, 0, 0, 0};
+    static_assert(LanternfishTable<18>::population(example) == 26);
+    static_assert(LanternfishTable<80>::population(example) == 5934);
+    static_assert(LanternfishTable<256>::population(example) == 26984457539);
+}
+
+TEST_CASE("day6", "[aoc2021]") {
+    auto counts = day6::parse_histogram("day6.txt");
+
+    uint64_t totalfish = day6::LanternfishTable<256>::population(counts);
     REQUIRE(totalfish == 1743335992042);
+    REQUIRE(totalfish == day6::simulate(counts, 256));
 
     std::cout << "lionfish: " << totalfish << "\n";
-}
\ No newline at end of file
+}
+
+TEST_CASE("day6 cycles", "[aoc2021]") {
+    // a variant with a shorter reproduction cycle and no juvenile delay
+    day6::Histogram<3, 3> counts{0, 2, 0, 1};
+
+    REQUIRE(day6::LanternfishTable<40, 3, 3>::population(counts) == day6::simulate<3, 3>(counts, 40));
+    REQUIRE(day6::LanternfishTable<80>::population(day6::example) == day6::simulate(day6::example, 80));
+}
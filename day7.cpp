@@ -1,29 +1,346 @@
 #include "util.h"
 
-int dist(int a, int b) {
-    if (b > a) {
-        return b - a;
+namespace day7 {
+    // wide enough for the total fuel of 10^9 crabs spread over 10^9 positions
+    using Fuel = __int128;
+
+    struct Best {
+        int64_t position;
+        Fuel cost;
+    };
+
+    // count, sum and sum of squares of the crab positions on one side of a candidate
+    struct Moments {
+        Fuel count;
+        Fuel sum;
+        Fuel squares;
+    };
+
+    struct Alignment;
+
+    // A fuel policy supplies the cost of moving one crab a distance d. It may also supply
+    // total(alignment, p), the fuel for every crab to reach p, and best(alignment), the optimum,
+    // when those have closed forms; otherwise they are found by scanning.
+    template <typename P>
+    concept FuelPolicy = requires(Fuel d) {
+        { P::cost(d) } -> std::convertible_to<Fuel>;
+    };
+
+    template <typename P>
+    concept TotalFuel = FuelPolicy<P> && requires(const Alignment& a, int64_t p) {
+        { P::total(a, p) } -> std::convertible_to<Fuel>;
+    };
+
+    template <typename P>
+    concept BestFuel = FuelPolicy<P> && requires(const Alignment& a) {
+        { P::best(a) } -> std::convertible_to<Best>;
+    };
+
+    struct Alignment {
+        std::vector<int64_t> positions; // distinct crab positions, sorted
+        std::vector<uint64_t> weights;  // crabs at each position
+        std::vector<Fuel> counts;       // prefix sums over positions, counts[i] covers positions[0..i)
+        std::vector<Fuel> sums;
+        std::vector<Fuel> squares;
+        std::vector<uint32_t> ranks;    // when dense, ranks[p - min] counts the positions at or left of p
+
+        // histogram maps each occupied position to the number of crabs there
+        explicit Alignment(const std::map<int64_t, uint64_t>& histogram) : counts(1), sums(1), squares(1) {
+            if (histogram.empty()) {
+                fail("no crabs to align");
+            }
+            for (auto [position, count]: histogram) {
+                Fuel p = position;
+                Fuel n = count;
+                positions.push_back(position);
+                weights.push_back(count);
+                counts.push_back(counts.back() + n);
+                sums.push_back(sums.back() + n * p);
+                squares.push_back(squares.back() + n * p * p);
+            }
+
+            // index every position of a beach that is not much wider than its crab count
+            uint64_t span = uint64_t(max_position() - min_position()) + 1;
+            if (span <= 8 * positions.size() + 4096) {
+                ranks.resize(span);
+                for (std::size_t i = 0; i < positions.size(); i++) {
+                    ranks[positions[i] - min_position()] = 1;
+                }
+                std::partial_sum(ranks.begin(), ranks.end(), ranks.begin());
+            }
+        }
+
+        explicit Alignment(const std::vector<int64_t>& crabs) : Alignment(histogram(crabs)) {}
+
+        static std::map<int64_t, uint64_t> histogram(const std::vector<int64_t>& crabs) {
+            std::map<int64_t, uint64_t> result;
+            for (int64_t c: crabs) {
+                result[c]++;
+            }
+            return result;
+        }
+
+        int64_t min_position() const {
+            return positions.front();
+        }
+
+        int64_t max_position() const {
+            return positions.back();
+        }
+
+        Fuel crab_count() const {
+            return counts.back();
+        }
+
+        // rounded down, including for negative positions where division rounds up
+        Fuel mean() const {
+            Fuel q = sums.back() / crab_count();
+            return q * crab_count() > sums.back() ? q - 1 : q;
+        }
+
+        // number of distinct positions at or left of p
+        std::size_t rank(int64_t p) const {
+            if (p < min_position()) {
+                return 0;
+            }
+            if (p >= max_position()) {
+                return positions.size();
+            }
+            if (!ranks.empty()) {
+                return ranks[p - min_position()];
+            }
+            return std::upper_bound(positions.begin(), positions.end(), p) - positions.begin();
+        }
+
+        // moments of the crabs at or left of p and of those right of p
+        std::pair<Moments, Moments> split(int64_t p) const {
+            std::size_t i = rank(p);
+            Moments left{counts[i], sums[i], squares[i]};
+            Moments right{counts.back() - counts[i], sums.back() - sums[i], squares.back() - squares[i]};
+            return std::make_pair(left, right);
+        }
+
+        // fuel for every crab to reach p, one term per occupied position
+        template <FuelPolicy P>
+        Fuel scan(int64_t p) const {
+            Fuel total = 0;
+            for (std::size_t i = 0; i < positions.size(); i++) {
+                Fuel d = p < positions[i] ? positions[i] - p : p - positions[i];
+                total += weights[i] * P::cost(d);
+            }
+            return total;
+        }
+
+        template <FuelPolicy P>
+        Fuel cost(int64_t p) const {
+            if constexpr (TotalFuel<P>) {
+                return P::total(*this, p);
+            } else {
+                return scan<P>(p);
+            }
+        }
+
+        // smallest position in [lo, hi] minimizing a convex cost
+        Best minimize(auto cost, int64_t lo, int64_t hi) const {
+            while (lo < hi) {
+                int64_t mid = lo + (hi - lo) / 2;
+                if (cost(mid) <= cost(mid + 1)) {
+                    hi = mid;
+                } else {
+                    lo = mid + 1;
+                }
+            }
+            return {lo, cost(lo)};
+        }
+
+        // evaluates every candidate position, for costs without a closed form, keeping only the
+        // best so far on each thread
+        template <FuelPolicy P>
+        Best scan_best() const {
+            int64_t lo = min_position();
+            auto cheaper = [](Best a, Best b) {
+                return b.cost < a.cost || (b.cost == a.cost && b.position < a.position) ? b : a;
+            };
+            return parallel_reduce(max_position() - lo + 1, Best{lo, scan<P>(lo)}, cheaper, [this, lo](std::size_t i) {
+                return Best{lo + int64_t(i), scan<P>(lo + int64_t(i))};
+            });
+        }
+
+        template <FuelPolicy P>
+        Best best() const {
+            if constexpr (BestFuel<P>) {
+                return P::best(*this);
+            } else if constexpr (TotalFuel<P>) {
+                return minimize([this](int64_t p) { return P::total(*this, p); }, min_position(), max_position());
+            } else {
+                return scan_best<P>();
+            }
+        }
+    };
+
+    struct Linear {
+        static Fuel cost(Fuel d) {
+            return d;
+        }
+
+        static Fuel total(const Alignment& a, int64_t p) {
+            auto [l, r] = a.split(p);
+            return (p * l.count - l.sum) + (r.sum - p * r.count);
+        }
+
+        // minimized at the median crab
+        static Best best(const Alignment& a) {
+            auto median = std::lower_bound(a.counts.begin() + 1, a.counts.end(), (a.crab_count() + 1) / 2);
+            int64_t p = a.positions[median - a.counts.begin() - 1];
+            return {p, total(a, p)};
+        }
+    };
+
+    struct Quadratic {
+        static Fuel cost(Fuel d) {
+            return d * d;
+        }
+
+        static Fuel total(const Alignment& a, int64_t p) {
+            Fuel n = a.crab_count();
+            return Fuel{p} * p * n - 2 * p * a.sums.back() + a.squares.back();
+        }
+
+        // minimized at the mean, rounded either way
+        static Best best(const Alignment& a) {
+            int64_t mean = a.mean();
+            return a.minimize([&a](int64_t p) { return total(a, p); }, mean, std::min(a.max_position(), mean + 1));
+        }
+    };
+
+    struct Triangular {
+        static Fuel cost(Fuel d) {
+            return d * (d + 1) / 2;
+        }
+
+        // sum of d*(d+1)/2 is (sum of d^2 + sum of d)/2
+        static Fuel total(const Alignment& a, int64_t p) {
+            return (Quadratic::total(a, p) + Linear::total(a, p)) / 2;
+        }
+
+        // minimized within half a step of the mean
+        static Best best(const Alignment& a) {
+            int64_t mean = a.mean();
+            int64_t lo = std::max(a.min_position(), mean - 1);
+            int64_t hi = std::min(a.max_position(), mean + 2);
+            return a.minimize([&a](int64_t p) { return total(a, p); }, lo, hi);
+        }
+    };
+
+    std::vector<int64_t> parse_crabs(const std::string& path) {
+        auto input = split_char(slurp(path)[0], ',');
+        return to_vec(input | std::views::transform([](const std::string& s) { return int64_t{to_int(s)}; }));
     }
-    return a - b;
 }
 
-TEST_CASE("day7", "[aoc2021]") {
-    auto input = split_char(slurp("day7.txt")[0], ',');
-    auto positions = input | std::views::transform(to_int);
+TEST_CASE("day7e", "[aoc2021]") {
+    day7::Alignment a(day7::parse_crabs("day7example.txt"));
+
+    auto linear = a.best<day7::Linear>();
+    REQUIRE(linear.position == 2);
+    REQUIRE(linear.cost == 37);
+
+    auto triangular = a.best<day7::Triangular>();
+    REQUIRE(triangular.position == 5);
+    REQUIRE(triangular.cost == 168);
 
-    auto best = std::make_pair(0, std::numeric_limits<uint64_t>::max());
+    for (int64_t p = a.min_position(); p <= a.max_position(); p++) {
+        REQUIRE(a.cost<day7::Linear>(p) >= linear.cost);
+        REQUIRE(a.cost<day7::Triangular>(p) >= triangular.cost);
+    }
 
-    for (int p = 0; p < positions.size(); p++) {
-        uint64_t cost = 0;
-        for (int loc: positions) {
-            uint64_t d = dist(loc, p);
-            cost += ((d * (d+1)) / 2);
+    REQUIRE(!a.ranks.empty());
+    for (int64_t p = a.min_position() - 2; p <= a.max_position() + 2; p++) {
+        REQUIRE(a.cost<day7::Linear>(p) == a.scan<day7::Linear>(p));
+    }
+}
+
+namespace day7 {
+    // closed-form policies stripped down to their per-crab cost, to exercise the scan
+    template <FuelPolicy P>
+    struct ScanOnly {
+        static Fuel cost(Fuel d) {
+            return P::cost(d);
         }
-        if (cost < best.second) {
-            best = std::make_pair(p, cost);
+    };
+
+    struct Cubic {
+        static Fuel cost(Fuel d) {
+            return d * d * d;
         }
+    };
+}
+
+TEST_CASE("day7 policies", "[aoc2021]") {
+    day7::Alignment a(day7::parse_crabs("day7.txt"));
+
+    auto check = [&a]<typename P>(P) {
+        auto best = a.best<P>();
+        auto scanned = a.best<day7::ScanOnly<P>>();
+        REQUIRE(best.position == scanned.position);
+        REQUIRE(best.cost == scanned.cost);
+        for (int64_t p: {a.min_position(), best.position - 1, best.position + 1, a.max_position()}) {
+            REQUIRE(a.cost<P>(p) == a.scan<P>(p));
+        }
+    };
+    check(day7::Linear{});
+    check(day7::Quadratic{});
+    check(day7::Triangular{});
+
+    auto cubic = a.best<day7::Cubic>();
+    REQUIRE(a.cost<day7::Cubic>(cubic.position - 1) > cubic.cost);
+    REQUIRE(a.cost<day7::Cubic>(cubic.position + 1) > cubic.cost);
+}
+
+TEST_CASE("day7 negative positions", "[aoc2021]") {
+    for (const auto& crabs: {std::vector<int64_t>{-2, -2, -1}, std::vector<int64_t>{-7, -3, 2, -1, -1}, std::vector<int64_t>{-5}}) {
+        day7::Alignment a(crabs);
+
+        auto check = [&a]<typename P>(P) {
+            auto best = a.best<P>();
+            auto scanned = a.best<day7::ScanOnly<P>>();
+            REQUIRE(best.position == scanned.position);
+            REQUIRE(best.cost == scanned.cost);
+        };
+        check(day7::Linear{});
+        check(day7::Quadratic{});
+        check(day7::Triangular{});
+    }
+
+    auto quadratic = day7::Alignment(std::vector<int64_t>{-2, -2, -1}).best<day7::Quadratic>();
+    REQUIRE(quadratic.position == -2);
+    REQUIRE(quadratic.cost == 1);
+}
+
+TEST_CASE("day7", "[aoc2021]") {
+    day7::Alignment a(day7::parse_crabs("day7.txt"));
+
+    REQUIRE(a.best<day7::Linear>().cost == 355592);
+
+    auto best = a.best<day7::Triangular>();
+
+    std::cout << "best position is: " << best.position << " cost " << uint64_t(best.cost) << "\n";
+    REQUIRE(best.cost == 101618069);
+}
+
+TEST_CASE("day7 many crabs", "[aoc2021]") {
+    // 10^9 crabs at each end of a 10^9 wide beach overflow 64 bits of triangular fuel
+    day7::Alignment a(std::map<int64_t, uint64_t>{{0, 1000000000}, {1000000000, 1000000000}});
+
+    REQUIRE(a.ranks.empty());
+    for (int64_t p: {-1, 0, 1, 499999999, 1000000000, 1000000001}) {
+        REQUIRE(a.cost<day7::Linear>(p) == a.scan<day7::Linear>(p));
     }
 
-    std::cout << "best position is: " << best.first << " cost " << best.second << "\n";
-    REQUIRE(best.second == 101618069);
+    auto best = a.best<day7::Triangular>();
+    REQUIRE(best.position == 500000000);
+
+    day7::Fuel half = 500000000;
+    REQUIRE(best.cost == day7::Fuel{2000000000} * (half * (half + 1) / 2));
+    REQUIRE(best.cost > std::numeric_limits<uint64_t>::max());
 }
@@ -1,183 +1,428 @@
 #include "util.h"
+#include <bit>
+#include <thread>
 
-bool is_unique_seq(const std::string& p) {
-    switch (p.size()) {
-        case 2:
-        case 4:
-        case 3:
-        case 7:
-            return true;
+namespace day8 {
+    // one bit per wire, bit 0 for 'a' through bit 6 for 'g'
+    using Segments = uint8_t;
+
+    constexpr Segments all_segments = 0x7f;
+
+    constexpr Segments to_segments(std::string_view s) {
+        Segments result = 0;
+        for (char c: s) {
+            result |= 1 << (c - 'a');
+        }
+        return result;
     }
-    return false;
-}
 
-std::string sorted(const std::string& s) {
-    std::string result = s;
-    std::sort(result.begin(), result.end());
-    return result;
-}
+    int segment_count(Segments s) {
+        return std::popcount(s);
+    }
 
-std::string difference(const std::string& a, const std::string& b) {
-    std::string result;
-    std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
-    std::sort(result.begin(), result.end());
-    return result;
-}
-std::string differences(const std::vector<std::string>& v) {
-    return std::accumulate(std::next(v.begin()), v.end(), v.front(), difference);
-}
+    bool is_unique_seq(Segments p) {
+        switch (segment_count(p)) {
+            case 2:
+            case 4:
+            case 3:
+            case 7:
+                return true;
+        }
+        return false;
+    }
 
-std::string differences(const auto&... args) {
-    std::vector<std::string> result;
-    (result.push_back(args), ...);
-    return differences(result);
-}
+    constexpr std::array<Segments, 10> digit_segments = {
+            to_segments("abcefg"),   // 0
+            to_segments("cf"),       // 1
+            to_segments("acdeg"),    // 2
+            to_segments("acdfg"),    // 3
+            to_segments("bcdf"),     // 4
+            to_segments("abdfg"),    // 5
+            to_segments("abdefg"),   // 6
+            to_segments("acf"),      // 7
+            to_segments("abcdefg"),  // 8
+            to_segments("abcdfg")    // 9
+    };
 
-std::string intersection(const std::string& a, const std::string& b) {
-    std::string result;
-    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
-    std::sort(result.begin(), result.end());
-    return result;
-}
+    // digit lit by each combination of unscrambled segments, -1 if none
+    constexpr std::array<int8_t, 128> digit_table = [] {
+        std::array<int8_t, 128> result{};
+        result.fill(-1);
+        for (int d = 0; d < 10; d++) {
+            result[digit_segments[d]] = d;
+        }
+        return result;
+    }();
 
-std::string intersections(const std::string& a, const auto&... args) {
-    return (intersection(a, args), ...);
-}
+    int to_digit(Segments s) {
+        return digit_table[s];
+    }
 
-std::string intersections(const std::vector<std::string>& v) {
-    return std::accumulate(std::next(v.begin()), v.end(), v.front(), intersection);
-}
+    struct DecodeKey {
+        std::array<Segments, 7> wires; // wires[i] is the scrambled wire driving segment 'a' + i
 
-struct DecodeKey {
-    std::string key;
+        Segments decode(Segments x) const {
+            Segments result = 0;
+            for (int i = 0; i < 7; i++) {
+                if (x & wires[i]) {
+                    result |= 1 << i;
+                }
+            }
+            return result;
+        }
 
-    char decode(char x) {
-        auto it = std::find(key.begin(), key.end(), x);
-        return 'a' + (it - key.begin());
-    }
+        int digit(Segments x) const {
+            return to_digit(decode(x));
+        }
+    };
 
-    std::string decode(const std::string& x) {
-        std::string result;
-        std::transform(x.begin(), x.end(), std::back_inserter(result), [&](char x){return decode(x);});
-        return sorted(result);
-    }
-};
+    // Summing, over the segments a digit lights, how many of the ten digits light each segment
+    // gives a number unique to the digit. Wire frequencies are the same whatever the scrambling,
+    // so the sum identifies a scrambled digit too. Malformed input can light all 7 wires in all
+    // 10 patterns, so the table covers sums up to 70, -1 where no digit matches.
+    constexpr std::array<int8_t, 7 * 10 + 1> signature_table = [] {
+        std::array<int, 7> frequency{};
+        for (Segments s: digit_segments) {
+            for (int i = 0; i < 7; i++) {
+                frequency[i] += (s >> i) & 1;
+            }
+        }
 
-struct DisplayInfo {
-    std::array<std::string, 10> patterns;
-    std::array<std::string, 4>  output;
+        std::array<int8_t, 7 * 10 + 1> result{};
+        result.fill(-1);
+        for (int d = 0; d < 10; d++) {
+            int signature = 0;
+            for (int i = 0; i < 7; i++) {
+                if (digit_segments[d] & (1 << i)) {
+                    signature += frequency[i];
+                }
+            }
+            result[signature] = d;
+        }
+        return result;
+    }();
+
+    struct SignatureKey {
+        std::array<uint8_t, 7> frequency; // patterns lighting each scrambled wire
+
+        int digit(Segments x) const {
+            int signature = 0;
+            for (int i = 0; i < 7; i++) {
+                if (x & (1 << i)) {
+                    signature += frequency[i];
+                }
+            }
+            return signature_table[signature];
+        }
+    };
 
-    std::string find_size(size_t len) const {
-        auto f = std::find_if(patterns.begin(), patterns.end(), [len](const std::string& x) { return x.size() == len; });
-        if (f == patterns.end()) {
+    struct DisplayInfo {
+        std::array<Segments, 10> patterns;
+        std::array<Segments, 4>  output;
+
+        Segments find_size(int len) const {
+            for (Segments p: patterns) {
+                if (segment_count(p) == len) {
+                    return p;
+                }
+            }
             fail(std::format("failed to find with size {} ", len));
+            return 0;
         }
-        return *f;
-    }
 
-    std::vector<std::string> copy_size(size_t len) const {
-        std::vector<std::string> result;
-        std::copy_if(patterns.begin(), patterns.end(), std::back_inserter(result), [len](const std::string& x) { return x.size() == len; });
-        return result;
-    }
+        // segments common to every pattern of the given size
+        Segments intersect_size(int len) const {
+            Segments result = all_segments;
+            for (Segments p: patterns) {
+                if (segment_count(p) == len) {
+                    result &= p;
+                }
+            }
+            return result;
+        }
+
+        DecodeKey crack() const {
+            auto one = find_size(2);
+            auto four = find_size(4);
+            auto seven = find_size(3);
+            auto eight = find_size(7);
 
-    DecodeKey crack() const {
-        auto one = find_size(2);
-        auto four = find_size(4);
-        auto seven = find_size(3);
-        auto eight = find_size(7);
+            // a - seven - one
+            auto a = seven & ~one;
 
-        //std::cout << std::format("1: {} 4: {} 7: {} 8: {}\n", one, four, seven, eight);
+            // d - intersect (2, 3, 4, 5) (5 lengths)
+            auto midthree = intersect_size(5);
+            auto d = midthree & four;
 
-        // a - seven - one
-        auto a = difference(seven, one);
-        //std::cout << "A: " << a << "\n";
+            // b - four - a - one - d
+            auto b = four & ~(a | one | d);
 
-        auto fivesize = copy_size(5);
-        auto midthree = intersections(fivesize);
-        //std::cout << "middle three: " << midthree << "\n";
+            // g - intersect 5 lengths - a - d
+            auto g = midthree & ~(a | d);
 
-        // d - intersect (2, 3, 4, 5) (5 lengths)
-        auto d = intersection(midthree, four);
-        //std::cout << "D: " << d << "\n";
+            // e - eight - seven - four - g
+            auto e = eight & ~(seven | four | g);
 
-        // b - four - a - one - d
-        auto b = differences(four, a, one, d);
-        //std::cout << "B: " << b << "\n";
+            // f - intersect 6 lengths with 1
+            auto f = intersect_size(6) & one;
 
-        // g - intersect 5 lengths - a - d
-        auto g = differences(midthree, a, d);
-        //std::cout << "G: " << g << "\n";
+            // c - one - f
+            auto c = one & ~f;
 
-        // e - eight - seven - four - g
-        auto e = differences(eight, seven, four, g);
-        //std::cout << "E: " << e << "\n";
+            return {{Segments(a), Segments(b), Segments(c), Segments(d), Segments(e), Segments(f), Segments(g)}};
+        }
+
+        // per-wire frequencies in a single pass, no deduction chain
+        SignatureKey crack_signature() const {
+            SignatureKey key{};
+            for (Segments p: patterns) {
+                for (int i = 0; i < 7; i++) {
+                    key.frequency[i] += (p >> i) & 1;
+                }
+            }
+            return key;
+        }
+
+        int value(const auto& key) const {
+            int val = 0;
+            for (Segments s: output) {
+                val = (val * 10) + key.digit(s);
+            }
+            return val;
+        }
+    };
 
-        // f - intersect 6 lengths with 1
-        auto f = intersection(intersections(copy_size(6)), one);
-        //std::cout << "F: " << f << "\n";
+    // Parses ten patterns, a '|' and four outputs. Errors are thrown without fail()'s errno
+    // suffix, which means nothing for a parse and is unrelated on parse_log's worker threads.
+    DisplayInfo parse_display(std::string_view line) {
+        DisplayInfo info{};
+        std::size_t idx = 0;
+        Segments current = 0;
+        bool outputs = false;
+
+        auto emit = [&] {
+            if (current == 0) {
+                return;
+            }
+            if (idx < 10) {
+                info.patterns[idx] = current;
+            } else if (idx < 14) {
+                info.output[idx - 10] = current;
+            }
+            idx++;
+            current = 0;
+        };
 
-        // c - one - f
-        auto c = difference(one, f);
-        //std::cout << "C: " << c << "\n";
+        for (char c: line) {
+            if (c >= 'a' && c <= 'g') {
+                current |= 1 << (c - 'a');
+            } else if (c == ' ') {
+                emit();
+            } else if (c == '|') {
+                emit();
+                if (outputs || idx != 10) {
+                    throw std::runtime_error(std::format("expected 10 patterns before '|' but got {}", idx));
+                }
+                outputs = true;
+            } else {
+                throw std::runtime_error(std::format("unexpected '{}' in display", c));
+            }
+        }
+        emit();
 
-        return {a + b + c + d + e + f + g};
+        if (!outputs) {
+            throw std::runtime_error("missing '|' before the outputs");
+        }
+        if (idx != 14) {
+            throw std::runtime_error(std::format("expected 4 outputs but got {}", idx - 10));
+        }
+        return info;
     }
-};
 
-int to_digit(const std::string& s) {
-    static std::vector<std::string> digits = {
-            "abcefg",   // 0
-            "cf",       // 1
-            "acdeg",    // 2
-            "acdfg",    // 3
-            "bcdf",     // 4
-            "abdfg",    // 5
-            "abdefg",   // 6
-            "acf",      // 7
-            "abcdefg",  // 8
-            "abcdfg"    // 9
-    };
-    auto it = std::find(digits.begin(), digits.end(), s);
-    if (it == digits.end()) {
-        return -1;
+    // displays are 14 packed bytes so a log is one contiguous array
+    static_assert(sizeof(DisplayInfo) == 14);
+
+    void for_each_line(std::string_view text, auto f) {
+        while (!text.empty()) {
+            std::size_t end = std::min(text.find('\n'), text.size());
+            if (end > 0) {
+                f(text.substr(0, end));
+            }
+            text.remove_prefix(std::min(end + 1, text.size()));
+        }
     }
-    return it - digits.begin();
+
+    // Splits text on line boundaries into roughly equal chunks, counts the lines in every chunk
+    // in parallel, then parses each chunk into its own slice of the result. A chunk stops at its
+    // first bad line, and the earliest bad line in the log is reported once every chunk is done.
+    std::vector<DisplayInfo> parse_log(std::string_view text, std::size_t chunk_count = thread_count()) {
+        chunk_count = std::max<std::size_t>(chunk_count, 1);
+        std::vector<std::string_view> chunks;
+        std::size_t begin = 0;
+        for (std::size_t i = 1; i <= chunk_count && begin < text.size(); i++) {
+            std::size_t end = text.size();
+            if (i < chunk_count) {
+                end = std::max(begin, text.size() * i / chunk_count);
+                end = std::min(text.find('\n', end), text.size());
+            }
+            chunks.push_back(text.substr(begin, end - begin));
+            begin = end + 1;
+        }
+
+        std::vector<std::size_t> offsets(chunks.size());
+        parallel_for(chunks.size(), [&](std::size_t i) {
+            for_each_line(chunks[i], [&offsets, i](std::string_view) { offsets[i]++; });
+        });
+        std::size_t total = std::accumulate(offsets.begin(), offsets.end(), std::size_t{0});
+        std::exclusive_scan(offsets.begin(), offsets.end(), offsets.begin(), std::size_t{0});
+
+        std::vector<DisplayInfo> result(total);
+        std::vector<std::optional<std::pair<std::size_t, std::string>>> errors(chunks.size());
+        parallel_for(chunks.size(), [&](std::size_t i) {
+            std::size_t n = offsets[i];
+            for_each_line(chunks[i], [&](std::string_view line) {
+                if (errors[i]) {
+                    return;
+                }
+                try {
+                    result[n] = parse_display(line);
+                    n++;
+                } catch (const std::exception& e) {
+                    errors[i].emplace(n, e.what());
+                }
+            });
+        });
+
+        for (const auto& e: errors) {
+            if (e) {
+                throw std::runtime_error(std::format("display {}: {}", e->first, e->second));
+            }
+        }
+        return result;
+    }
+
+    std::size_t count_unique(const std::vector<DisplayInfo>& displays) {
+        return parallel_reduce(displays.size(), std::size_t{0}, std::plus<>(), [&displays](std::size_t i) {
+            const auto& d = displays[i];
+            return std::size_t(std::count_if(d.output.begin(), d.output.end(), is_unique_seq));
+        });
+    }
+
+    std::vector<int> decode_all(const std::vector<DisplayInfo>& displays) {
+        std::vector<int> result(displays.size());
+        parallel_for(displays.size(), [&](std::size_t i) {
+            result[i] = displays[i].value(displays[i].crack_signature());
+        });
+        return result;
+    }
+
+    uint64_t sum_values(const std::vector<DisplayInfo>& displays) {
+        return parallel_reduce(displays.size(), uint64_t{0}, std::plus<>(), [&displays](std::size_t i) {
+            return uint64_t(displays[i].value(displays[i].crack_signature()));
+        });
+    }
+}
+
+TEST_CASE("day8e", "[aoc2021]") {
+    auto info = day8::parse_display("acedgfb cdfbe gcdfa fbcad dab cefabd cdfgeb eafb cagedb ab | cdfeb fcadb cdfeb cdbaf");
+    auto key = info.crack();
+
+    REQUIRE(key.decode(day8::to_segments("acedgfb")) == day8::to_segments("abcdefg"));
+    REQUIRE(day8::to_digit(key.decode(day8::to_segments("dab"))) == 7);
+    REQUIRE(info.value(key) == 5353);
+    REQUIRE(info.value(info.crack_signature()) == 5353);
+
+    auto lit = day8::parse_display("abcdefg abcdefg abcdefg abcdefg abcdefg abcdefg abcdefg abcdefg abcdefg abcdefg | abcdefg a b c");
+    REQUIRE(lit.crack_signature().digit(day8::all_segments) == -1);
 }
 
 TEST_CASE("day8", "[aoc2021]") {
-    std::vector<DisplayInfo> input;
+    std::vector<day8::DisplayInfo> input;
     auto lines = slurp("day8.txt");
     for (const std::string& line: lines) {
-        auto parts = split_space(line);
-        DisplayInfo info{};
-        for (int i = 0; i < 10; i++) {
-            info.patterns[i] = sorted(parts[i]);
-        }
-        for (int i = 0; i < 4; i++) {
-            info.output[i] = sorted(parts[i+11]);
-        }
-        input.push_back(info);
+        input.push_back(day8::parse_display(line));
     }
 
     int count = 0;
     for (const auto& i: input) {
-        count += std::count_if(i.output.begin(), i.output.end(), is_unique_seq);
+        count += std::count_if(i.output.begin(), i.output.end(), day8::is_unique_seq);
     }
 
     REQUIRE(count == 473);
 
     int total = 0;
+    int signature_total = 0;
     for (const auto& i: input) {
-        auto key = i.crack();
-
-        int val = 0;
-        for (const auto& s: i.output) {
-            auto v = key.decode(s);
-            auto digit = to_digit(v);
-            val = (val * 10) + digit;
-        }
-        total += val;
+        total += i.value(i.crack());
+        signature_total += i.value(i.crack_signature());
     }
     REQUIRE(total == 1097568);
-}
\ No newline at end of file
+    REQUIRE(signature_total == 1097568);
+}
+
+TEST_CASE("day8 malformed", "[aoc2021]") {
+    const std::string patterns = "acedgfb cdfbe gcdfa fbcad dab cefabd cdfgeb eafb cagedb ab";
+    REQUIRE_THROWS_WITH(day8::parse_display("abhc cdfbe gcdfa fbcad dab cefabd cdfgeb eafb cagedb ab | cdfeb fcadb cdfeb cdbaf"),
+                        "unexpected 'h' in display");
+    REQUIRE_THROWS_WITH(day8::parse_display(patterns + " cdfeb fcadb cdfeb cdbaf"), "missing '|' before the outputs");
+    REQUIRE_THROWS_WITH(day8::parse_display(patterns + " dab | fcadb cdfeb cdbaf"), "expected 10 patterns before '|' but got 11");
+    REQUIRE_THROWS_WITH(day8::parse_display(patterns + " | cdfeb | fcadb cdfeb cdbaf"), "expected 10 patterns before '|' but got 11");
+    REQUIRE_THROWS_WITH(day8::parse_display(patterns + " | cdfeb fcadb cdfeb"), "expected 4 outputs but got 3");
+    REQUIRE_THROWS_WITH(day8::parse_display(patterns + " | cdfeb fcadb cdfeb cdbaf ab"), "expected 4 outputs but got 5");
+
+    auto tight = day8::parse_display(patterns + "|cdfeb fcadb cdfeb cdbaf");
+    REQUIRE(tight.value(tight.crack()) == 5353);
+}
+
+TEST_CASE("day8 batch", "[aoc2021]") {
+    auto text = slurp_text("day8.txt");
+
+    for (std::size_t chunks: {1, 3, 7, 64, 1000}) {
+        auto displays = day8::parse_log(text, chunks);
+        REQUIRE(displays.size() == 200);
+        REQUIRE(day8::count_unique(displays) == 473);
+        REQUIRE(day8::sum_values(displays) == 1097568);
+    }
+
+    // a bad line is reported after the parallel parse rather than terminating it
+    std::string bad = text;
+    std::size_t at = text.find('\n', text.size() / 2) + 1;
+    bad.insert(at, "abc | def\n");
+    auto expected = std::format("display {}: expected 10 patterns before '|' but got 1", std::count(text.begin(), text.begin() + at, '\n'));
+    REQUIRE_THROWS_WITH(day8::parse_log(bad, 4), expected);
+
+    auto displays = day8::parse_log(text);
+    auto values = day8::decode_all(displays);
+    auto lines = slurp("day8.txt");
+    for (std::size_t i = 0; i < lines.size(); i++) {
+        auto d = day8::parse_display(lines[i]);
+        REQUIRE(values[i] == d.value(d.crack()));
+    }
+}
+
+TEST_CASE("day8 benchmark", "[.][benchmark]") {
+    std::vector<day8::DisplayInfo> input;
+    for (const std::string& line: slurp("day8.txt")) {
+        input.push_back(day8::parse_display(line));
+    }
+
+    BENCHMARK("crack") {
+        int total = 0;
+        for (const auto& i: input) {
+            total += i.value(i.crack());
+        }
+        return total;
+    };
+
+    BENCHMARK("crack_signature") {
+        int total = 0;
+        for (const auto& i: input) {
+            total += i.value(i.crack_signature());
+        }
+        return total;
+    };
+
+    BENCHMARK("sum_values") {
+        return day8::sum_values(input);
+    };
+}
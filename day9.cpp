@@ -1,122 +1,669 @@
 #include "util.h"
+#include <atomic>
+#include <bit>
+#include <random>
+#include <set>
+#include <unordered_set>
 
-struct Map {
-    std::vector<int8_t> map;
-    int width;
-    int height;
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DAY9_HAVE_AVX2 1
+#endif
 
-    Map(int w, int h) : width(w), height(h), map(w*h, 0) {}
-
-    int8_t& at(int x, int y) {
-        return map[y * width + x];
+namespace day9 {
+    // labels are 32 bits, so maps up to 2^32 padded cells
+    inline void check_label_count(std::size_t n) {
+        if (n > std::numeric_limits<uint32_t>::max()) {
+            fail(std::format("{} cells are too many to label with 32 bits", n));
+        }
     }
 
-    const int8_t at(int x, int y) const {
-        if (x < 0 || y < 0 || x >= width || y >= height) {
-            return 9;
+    struct UnionFind {
+        std::vector<uint32_t> parent;
+        std::vector<uint32_t> size;
+
+        explicit UnionFind(std::size_t n) : parent(n), size(n, 1) {
+            check_label_count(n);
+            std::iota(parent.begin(), parent.end(), uint32_t{0});
         }
-        return map[y * width + x];
-    }
 
-    auto adjacent(int x, int y) const {
-        return std::make_tuple(at(x-1, y), at(x+1, y), at(x, y-1), at(x, y+1));
-    }
+        uint32_t find(uint32_t x) {
+            while (parent[x] != x) {
+                parent[x] = parent[parent[x]];
+                x = parent[x];
+            }
+            return x;
+        }
 
-    bool is_low(int x, int y) const {
-        auto v = at(x, y);
-        auto [a, b, c, d] = adjacent(x, y);
+        void unite(uint32_t a, uint32_t b) {
+            a = find(a);
+            b = find(b);
+            if (a == b) {
+                return;
+            }
+            if (size[a] < size[b]) {
+                std::swap(a, b);
+            }
+            parent[b] = a;
+            size[a] += size[b];
+        }
+    };
 
-        return v < a && v < b && v < c && v < d;
-    }
+    // Union-find safe to share between threads. Roots are always linked under the smaller index,
+    // so every component ends up rooted at its first cell whatever order the unions ran in.
+    struct ConcurrentUnionFind {
+        std::vector<std::atomic<uint32_t>> parent;
 
-    std::vector<std::pair<int,int>> find_lows() const {
-        std::vector<std::pair<int,int>> result;
+        explicit ConcurrentUnionFind(std::size_t n) : parent(n) {}
 
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                if (is_low(x, y)) {
-                    result.emplace_back(x, y);
+        void reset(uint32_t x) {
+            parent[x].store(x, std::memory_order_relaxed);
+        }
+
+        uint32_t find(uint32_t x) {
+            while (true) {
+                uint32_t p = parent[x].load();
+                if (p == x) {
+                    return x;
+                }
+                uint32_t gp = parent[p].load();
+                if (p != gp) {
+                    parent[x].compare_exchange_weak(p, gp);
                 }
+                x = gp;
             }
         }
 
-        return result;
-    }
+        void unite(uint32_t a, uint32_t b) {
+            while (true) {
+                a = find(a);
+                b = find(b);
+                if (a == b) {
+                    return;
+                }
+                if (a < b) {
+                    std::swap(a, b);
+                }
+                if (parent[a].compare_exchange_strong(a, b)) {
+                    return;
+                }
+            }
+        }
+    };
+
+    struct Basin {
+        std::size_t size;
+        std::pair<int,int> low;
+        int8_t low_height;
+    };
+
+    struct Tile {
+        int x0, y0, x1, y1;
+    };
+
+    // one bit per cell, bit x % 32 of word x / 32 in each row
+    struct LowPoints {
+        std::vector<uint32_t> bitmap;
+        int words_per_row;
+        int risk_level;
+    };
+
+    struct Map {
+        std::vector<int8_t> map;
+        int width;
+        int height;
+
+        // Cells are stored with a border of 9s so neighbors never need bounds checks. Rows are
+        // padded with 9s to a multiple of 32 cells, plus a tail so a 32 cell load from any
+        // row stays inside the buffer.
+        int stride;
 
-    void find_basin_r(int x, int y, std::vector<std::pair<int,int>>& basin) const {
-        auto p = std::make_pair(x, y);
-        if (basin.end() != std::find(basin.begin(), basin.end(), p)) {
-            return;
+        Map(int w, int h) : map((std::size_t(h) + 2) * padded_stride(w) + 64, 9), width(w), height(h), stride(padded_stride(w)) {
+            for (int y = 0; y < height; y++) {
+                std::fill_n(&at(0, y), width, 0);
+            }
         }
-        int8_t h = at(x, y);
-        if (h == 9) {
-            return;
+
+        static int padded_stride(int w) {
+            return (w + 2 + 31) / 32 * 32;
         }
 
-        basin.push_back(p);
+        int words_per_row() const {
+            return (width + 31) / 32;
+        }
 
-        find_basin_r(x-1, y, basin);
-        find_basin_r(x+1, y, basin);
-        find_basin_r(x, y+1, basin);
-        find_basin_r(x, y-1, basin);
-    }
+        // valid for -1 <= x <= width and -1 <= y <= height
+        std::size_t index(int x, int y) const {
+            return std::size_t(y + 1) * stride + x + 1;
+        }
+
+        int8_t& at(int x, int y) {
+            return map[index(x, y)];
+        }
+
+        const int8_t at(int x, int y) const {
+            return map[index(x, y)];
+        }
+
+        auto adjacent(int x, int y) const {
+            return std::make_tuple(at(x-1, y), at(x+1, y), at(x, y-1), at(x, y+1));
+        }
+
+        bool is_low(int x, int y) const {
+            auto v = at(x, y);
+            auto [a, b, c, d] = adjacent(x, y);
+
+            return v < a && v < b && v < c && v < d;
+        }
+
+        // Compares 32 cells of a row at a time against their four neighbors. Padding cells
+        // are 9 and so never low.
+        int scan_lows(uint32_t* bits) const {
+            int risk = 0;
+            for (int y = 0; y < height; y++) {
+                const int8_t* row = &map[index(0, y)];
+                for (int w = 0; w < words_per_row(); w++) {
+                    uint32_t mask = 0;
+                    for (int k = 0; k < 32; k++) {
+                        const int8_t* c = row + 32 * w + k;
+                        if (*c < c[-1] && *c < c[1] && *c < c[-stride] && *c < c[stride]) {
+                            mask |= uint32_t(1) << k;
+                            risk += 1 + *c;
+                        }
+                    }
+                    bits[std::size_t(y) * words_per_row() + w] = mask;
+                }
+            }
+            return risk;
+        }
+
+#ifdef DAY9_HAVE_AVX2
+        __attribute__((target("avx2")))
+        static __m256i load32(const int8_t* p) {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        }
+
+        __attribute__((target("avx2")))
+        int scan_lows_avx2(uint32_t* bits) const {
+            const __m256i zero = _mm256_setzero_si256();
+            __m256i heights = zero;
+            int count = 0;
+
+            for (int y = 0; y < height; y++) {
+                const int8_t* row = &map[index(0, y)];
+                for (int w = 0; w < words_per_row(); w++) {
+                    const int8_t* c = row + 32 * w;
+                    __m256i v = load32(c);
+                    __m256i low = _mm256_and_si256(
+                            _mm256_and_si256(_mm256_cmpgt_epi8(load32(c - 1), v), _mm256_cmpgt_epi8(load32(c + 1), v)),
+                            _mm256_and_si256(_mm256_cmpgt_epi8(load32(c - stride), v), _mm256_cmpgt_epi8(load32(c + stride), v)));
+
+                    uint32_t mask = _mm256_movemask_epi8(low);
+                    bits[std::size_t(y) * words_per_row() + w] = mask;
+                    count += std::popcount(mask);
+                    heights = _mm256_add_epi64(heights, _mm256_sad_epu8(_mm256_and_si256(low, v), zero));
+                }
+            }
+
+            alignas(32) uint64_t lanes[4];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), heights);
+            return count + int(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+        }
+#endif
+
+        LowPoints find_low_points() const {
+            LowPoints result{std::vector<uint32_t>(std::size_t(height) * words_per_row()), words_per_row(), 0};
+#ifdef DAY9_HAVE_AVX2
+            if (__builtin_cpu_supports("avx2")) {
+                result.risk_level = scan_lows_avx2(result.bitmap.data());
+                return result;
+            }
+#endif
+            result.risk_level = scan_lows(result.bitmap.data());
+            return result;
+        }
+
+        std::vector<std::pair<int,int>> find_lows() const {
+            std::vector<std::pair<int,int>> result;
+            auto lows = find_low_points();
+
+            for (std::size_t i = 0; i < lows.bitmap.size(); i++) {
+                int y = i / lows.words_per_row;
+                int x0 = (i % lows.words_per_row) * 32;
+                for (uint32_t mask = lows.bitmap[i]; mask != 0; mask &= mask - 1) {
+                    result.emplace_back(x0 + std::countr_zero(mask), y);
+                }
+            }
+
+            return result;
+        }
+
+        // iterative flood fill from (x, y), so large basins can't overflow the stack. Visited
+        // cells are kept in a set, so a fill costs the size of its basin rather than the map.
+        std::vector<std::pair<int,int>> find_basin(int x, int y) const {
+            std::vector<std::pair<int,int>> result;
+            if (at(x, y) == 9) {
+                return result;
+            }
+
+            std::unordered_set<std::size_t> visited{index(x, y)};
+            result.emplace_back(x, y);
+
+            for (std::size_t i = 0; i < result.size(); i++) {
+                auto [cx, cy] = result[i];
+                for (auto [nx, ny]: {std::make_pair(cx-1, cy), std::make_pair(cx+1, cy), std::make_pair(cx, cy-1), std::make_pair(cx, cy+1)}) {
+                    if (at(nx, ny) != 9 && visited.insert(index(nx, ny)).second) {
+                        result.emplace_back(nx, ny);
+                    }
+                }
+            }
+
+            return result;
+        }
+
+        // Labels every non-9 cell in one raster pass, joining each cell with its left and upper
+        // neighbors. Returns the size of every basin, largest first.
+        std::vector<std::size_t> basin_sizes() const {
+            UnionFind basins(map.size());
+
+            // the border of 9s stops unions at the map edges
+            for (std::size_t i = index(0, 0); i < index(width, height - 1); i++) {
+                if (map[i] == 9) {
+                    continue;
+                }
+                if (map[i - 1] != 9) {
+                    basins.unite(i, i - 1);
+                }
+                if (map[i - stride] != 9) {
+                    basins.unite(i, i - stride);
+                }
+            }
+
+            std::vector<std::size_t> result;
+            for (std::size_t i = 0; i < map.size(); i++) {
+                if (map[i] != 9 && basins.parent[i] == i) {
+                    result.push_back(basins.size[i]);
+                }
+            }
+            std::sort(result.begin(), result.end(), std::greater<>());
+
+            return result;
+        }
+
+        std::vector<Tile> tiles(int tile_size) const {
+            std::vector<Tile> result;
+            for (int y = 0; y < height; y += tile_size) {
+                for (int x = 0; x < width; x += tile_size) {
+                    result.push_back({x, y, std::min(x + tile_size, width), std::min(y + tile_size, height)});
+                }
+            }
+            return result;
+        }
 
-    std::vector<std::pair<int,int>> find_basin(int x, int y) const {
-        std::vector<std::pair<int,int>> result;
+        // Labels each tile on its own, merges labels across tile borders, then reduces every
+        // tile's cells into per-basin sizes and low points. Basins come back in the raster order
+        // of their first cell, and the lowest cell (first in raster order on ties) is the low
+        // point, so the result doesn't depend on the tiling or thread count.
+        std::vector<Basin> basins(int tile_size = 256) const {
+            check_label_count(map.size());
+            ConcurrentUnionFind labels(map.size());
+            auto ts = tiles(tile_size);
 
-        find_basin_r(x, y, result);
+            parallel_for(ts.size(), [&](std::size_t n) {
+                const Tile& t = ts[n];
+                for (int y = t.y0; y < t.y1; y++) {
+                    for (int x = t.x0; x < t.x1; x++) {
+                        std::size_t i = index(x, y);
+                        labels.reset(i);
+                        if (map[i] == 9) {
+                            continue;
+                        }
+                        if (x > t.x0 && map[i - 1] != 9) {
+                            labels.unite(i, i - 1);
+                        }
+                        if (y > t.y0 && map[i - stride] != 9) {
+                            labels.unite(i, i - stride);
+                        }
+                    }
+                }
+            });
+
+            parallel_for(ts.size(), [&](std::size_t n) {
+                const Tile& t = ts[n];
+                if (t.x0 > 0) {
+                    for (int y = t.y0; y < t.y1; y++) {
+                        std::size_t i = index(t.x0, y);
+                        if (map[i] != 9 && map[i - 1] != 9) {
+                            labels.unite(i, i - 1);
+                        }
+                    }
+                }
+                if (t.y0 > 0) {
+                    for (int x = t.x0; x < t.x1; x++) {
+                        std::size_t i = index(x, t.y0);
+                        if (map[i] != 9 && map[i - stride] != 9) {
+                            labels.unite(i, i - stride);
+                        }
+                    }
+                }
+            });
+
+            std::vector<std::unordered_map<uint32_t, Basin>> partials(ts.size());
+            parallel_for(ts.size(), [&](std::size_t n) {
+                const Tile& t = ts[n];
+                auto& partial = partials[n];
+                for (int y = t.y0; y < t.y1; y++) {
+                    for (int x = t.x0; x < t.x1; x++) {
+                        std::size_t i = index(x, y);
+                        if (map[i] == 9) {
+                            continue;
+                        }
+                        auto [it, inserted] = partial.try_emplace(labels.find(i), Basin{0, {x, y}, map[i]});
+                        it->second.size++;
+                        if (map[i] < it->second.low_height) {
+                            it->second.low = {x, y};
+                            it->second.low_height = map[i];
+                        }
+                    }
+                }
+            });
+
+            std::map<uint32_t, Basin> merged;
+            for (const auto& partial: partials) {
+                for (const auto& [root, b]: partial) {
+                    auto [it, inserted] = merged.try_emplace(root, b);
+                    if (inserted) {
+                        continue;
+                    }
+                    auto& m = it->second;
+                    m.size += b.size;
+                    auto key = [this](const Basin& x) { return std::make_pair(x.low_height, index(x.low.first, x.low.second)); };
+                    if (key(b) < key(m)) {
+                        m.low = b.low;
+                        m.low_height = b.low_height;
+                    }
+                }
+            }
+
+            return to_vec(merged | std::views::values);
+        }
 
+        int risk_level() const {
+            return find_low_points().risk_level;
+        }
+
+        void print() const {
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    std::cout << char('0' + at(x, y));
+                }
+                std::cout << "\n";
+            }
+        }
+    };
+
+    // product of the k largest sizes, sizes sorted largest first
+    std::vector<std::size_t> sizes(const std::vector<Basin>& basins) {
+        auto result = to_vec(basins | std::views::transform(&Basin::size));
+        std::sort(result.begin(), result.end(), std::greater<>());
         return result;
     }
 
-    void print() const {
+    uint64_t top_product(const std::vector<std::size_t>& sizes, std::size_t k = 3) {
+        return std::accumulate(sizes.begin(), sizes.begin() + std::min(k, sizes.size()), uint64_t{1}, std::multiplies<>());
+    }
+
+    // Keeps basin membership and sizes current while heights change. Only a change to or from
+    // 9 can alter the basins: lowering a 9 merges the basins around it by relabeling all but the
+    // largest, raising a cell to 9 relabels its old basin from each neighbor to find the pieces.
+    struct BasinTracker {
+        Map map;
+        std::vector<int> labels; // basin of each cell, -1 for 9s
+        std::unordered_map<int, std::size_t> basin_size;
+        std::multiset<std::size_t, std::greater<>> ordered_sizes;
+        int next_label = 0;
+
+        explicit BasinTracker(Map m) : map(std::move(m)), labels(map.map.size(), -1) {
+            for (int y = 0; y < map.height; y++) {
+                for (int x = 0; x < map.width; x++) {
+                    std::size_t i = map.index(x, y);
+                    if (map.map[i] != 9 && labels[i] == -1) {
+                        add_basin(next_label, relabel(i, -1, next_label));
+                        next_label++;
+                    }
+                }
+            }
+        }
+
+        std::array<std::size_t, 4> neighbors(std::size_t i) const {
+            return {i - 1, i + 1, i - map.stride, i + map.stride};
+        }
+
+        // flood fills the cells labeled from connected to start, returns how many were relabeled
+        std::size_t relabel(std::size_t start, int from, int to) {
+            std::vector<std::size_t> pending{start};
+            labels[start] = to;
+            std::size_t count = 0;
+
+            while (!pending.empty()) {
+                std::size_t i = pending.back();
+                pending.pop_back();
+                count++;
+                for (std::size_t n: neighbors(i)) {
+                    if (map.map[n] != 9 && labels[n] == from) {
+                        labels[n] = to;
+                        pending.push_back(n);
+                    }
+                }
+            }
+            return count;
+        }
+
+        void add_basin(int label, std::size_t size) {
+            basin_size[label] = size;
+            ordered_sizes.insert(size);
+        }
+
+        void remove_basin(int label) {
+            ordered_sizes.erase(ordered_sizes.find(basin_size[label]));
+            basin_size.erase(label);
+        }
+
+        void resize_basin(int label, std::size_t size) {
+            remove_basin(label);
+            add_basin(label, size);
+        }
+
+        void update(int x, int y, int8_t h) {
+            std::size_t i = map.index(x, y);
+            bool was_wall = map.map[i] == 9;
+            map.map[i] = h;
+            if (was_wall == (h == 9)) {
+                return;
+            }
+
+            if (was_wall) {
+                lower(i);
+            } else {
+                raise(i);
+            }
+        }
+
+        void lower(std::size_t i) {
+            int survivor = -1;
+            for (std::size_t n: neighbors(i)) {
+                if (labels[n] != -1 && (survivor == -1 || basin_size[labels[n]] > basin_size[survivor])) {
+                    survivor = labels[n];
+                }
+            }
+
+            if (survivor == -1) {
+                labels[i] = next_label;
+                add_basin(next_label++, 1);
+                return;
+            }
+
+            labels[i] = survivor;
+            std::size_t size = basin_size[survivor] + 1;
+            for (std::size_t n: neighbors(i)) {
+                int label = labels[n];
+                if (label != -1 && label != survivor) {
+                    remove_basin(label);
+                    size += relabel(n, label, survivor);
+                }
+            }
+            resize_basin(survivor, size);
+        }
+
+        void raise(std::size_t i) {
+            int label = labels[i];
+            labels[i] = -1;
+
+            auto around = neighbors(i);
+            int open = std::count_if(around.begin(), around.end(), [this](std::size_t n) { return labels[n] != -1; });
+            if (open == 0) {
+                remove_basin(label);
+                return;
+            }
+            if (open == 1) {
+                // a cell with a single open neighbor can't be holding its basin together
+                resize_basin(label, basin_size[label] - 1);
+                return;
+            }
+
+            remove_basin(label);
+            for (std::size_t n: around) {
+                if (labels[n] == label) {
+                    std::size_t size = relabel(n, label, next_label);
+                    add_basin(next_label++, size);
+                }
+            }
+        }
+
+        std::vector<std::size_t> sizes() const {
+            return to_vec(ordered_sizes);
+        }
+
+        uint64_t top_product(std::size_t k = 3) const {
+            uint64_t product = 1;
+            for (auto it = ordered_sizes.begin(); it != ordered_sizes.end() && k > 0; ++it, --k) {
+                product *= *it;
+            }
+            return product;
+        }
+    };
+
+    Map parse_map(const std::string& path) {
+        auto lines = slurp(path);
+        int width = lines[0].size();
+        int height = lines.size();
+        Map result(width, height);
+
         for (int y = 0; y < height; y++) {
+            const auto& line = lines[y];
             for (int x = 0; x < width; x++) {
-                std::cout << char('0' + at(x, y));
+                result.at(x, y) = line[x] - '0';
             }
-            std::cout << "\n";
         }
+
+        return result;
     }
-};
+}
 
-Map parse_map(const std::string& path) {
-    auto lines = slurp(path);
-    int width = lines[0].size();
-    int height = lines.size();
-    Map result(width, height);
+TEST_CASE("day9e", "[aoc2021]") {
+    day9::Map m = day9::parse_map("day9example.txt");
 
-    for (int y = 0; y < height; y++) {
-        auto line = lines[y];
-        for (int x = 0; x < width; x++) {
-            result.at(x, y) = line[x] - '0';
-        }
-    }
+    REQUIRE(m.risk_level() == 15);
 
-    return result;
+    auto sizes = m.basin_sizes();
+    REQUIRE(sizes == std::vector<std::size_t>{14, 9, 9, 3});
+    REQUIRE(day9::top_product(sizes) == 1134);
 }
 
 TEST_CASE("day9", "[aoc2021]") {
-    Map m = parse_map("day9.txt");
+    day9::Map m = day9::parse_map("day9.txt");
     //m.print();
 
+    REQUIRE(m.risk_level() == 560);
+
+    auto sizes = m.basin_sizes();
+    REQUIRE(day9::top_product(sizes) == 959136);
+
     auto lows = m.find_lows();
+    REQUIRE(sizes.size() == lows.size());
 
-    int sum;
-    for (auto l: lows) {
-        auto [x, y] = l;
-        sum += 1 + m.at(x, y);
+    auto basins = to_vec(lows | std::views::transform([&m](auto& pt) { return m.find_basin(pt.first, pt.second).size(); }));
+    std::sort(basins.begin(), basins.end(), std::greater<>());
+    REQUIRE(basins == sizes);
+}
+
+TEST_CASE("day9 tiles", "[aoc2021]") {
+    day9::Map m = day9::parse_map("day9.txt");
+
+    auto basins = m.basins();
+    auto sizes = day9::sizes(basins);
+    REQUIRE(sizes == m.basin_sizes());
+    REQUIRE(day9::top_product(sizes) == 959136);
 
+    auto lows = to_vec(basins | std::views::transform(&day9::Basin::low));
+    auto found = m.find_lows();
+    std::sort(lows.begin(), lows.end());
+    std::sort(found.begin(), found.end());
+    REQUIRE(lows == found);
+
+    for (int tile_size: {1, 3, 16, 37, 1000}) {
+        auto tiled = m.basins(tile_size);
+        REQUIRE(tiled.size() == basins.size());
+        for (std::size_t i = 0; i < basins.size(); i++) {
+            REQUIRE(tiled[i].size == basins[i].size);
+            REQUIRE(tiled[i].low == basins[i].low);
+        }
     }
-    REQUIRE(sum == 560);
+}
+
+TEST_CASE("day9 lows", "[aoc2021]") {
+    for (auto path: {"day9example.txt", "day9.txt"}) {
+        day9::Map m = day9::parse_map(path);
 
-    auto basins = to_vec(lows | std::views::transform([m](auto& pt) { return m.find_basin(pt.first, pt.second); }));
-    std::sort(basins.begin(), basins.end(), [](const auto&a, const auto& b) { return b.size() < a.size(); });
+        std::vector<std::pair<int,int>> expected;
+        int risk = 0;
+        for (int y = 0; y < m.height; y++) {
+            for (int x = 0; x < m.width; x++) {
+                if (m.is_low(x, y)) {
+                    expected.emplace_back(x, y);
+                    risk += 1 + m.at(x, y);
+                }
+            }
+        }
+        REQUIRE(m.find_lows() == expected);
+        REQUIRE(m.risk_level() == risk);
 
-    int product = 1;
-    for (int i = 0; i < 3; i++) {
-        product *= basins[i].size();
+        std::vector<uint32_t> bits(std::size_t(m.height) * m.words_per_row());
+        REQUIRE(m.scan_lows(bits.data()) == risk);
+        REQUIRE(bits == m.find_low_points().bitmap);
     }
-    REQUIRE(product == 959136);
+}
+
+TEST_CASE("day9 updates", "[aoc2021]") {
+    day9::Map m = day9::parse_map("day9.txt");
+    day9::BasinTracker tracker(m);
+
+    REQUIRE(tracker.sizes() == m.basin_sizes());
+    REQUIRE(tracker.top_product() == 959136);
 
+    std::mt19937 rng(9);
+    std::uniform_int_distribution<int> column(0, m.width - 1);
+    std::uniform_int_distribution<int> row(0, m.height - 1);
+    std::uniform_int_distribution<int> height(0, 9);
+    for (int n = 0; n < 500; n++) {
+        int x = column(rng);
+        int y = row(rng);
+        int8_t h = height(rng) < 5 ? 9 : height(rng);
+        m.at(x, y) = h;
+        tracker.update(x, y, h);
 
-}
\ No newline at end of file
+        auto expected = m.basin_sizes();
+        REQUIRE(tracker.sizes() == expected);
+        REQUIRE(tracker.top_product() == day9::top_product(expected));
+    }
+}
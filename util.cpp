@@ -1,4 +1,5 @@
 #include "util.h"
+#include <charconv>
 
 void fail(const std::string& msg){
     if (errno != -1) {
@@ -26,6 +27,18 @@ std::vector<std::string> slurp(const std::string& name, bool keep_empty) {
     return result;
 }
 
+std::string slurp_text(const std::string& name) {
+    std::string path = "../input/" + name;
+
+    std::ifstream f(path, std::ios::binary);
+    if (!f.is_open()) {
+        fail("open(" + path + ")");
+    }
+    std::stringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
 std::vector<std::string> split_char(const std::string& l, char delim) {
     std::vector<std::string> result{};
     std::istringstream ss(l);
@@ -19,6 +19,8 @@
 #include <unordered_map>
 #include <execution>
 #include <map>
+#include <thread>
+#include <exception>
 
 void dump(std::ranges::viewable_range auto&& r, std::ostream& out = std::cout, const char* delim = "\n") {
     using R = decltype(r);
@@ -43,6 +45,8 @@ void fail(const std::string& msg);
 
 std::vector<std::string> slurp(const std::string& name, bool keep_empty = false);
 
+std::string slurp_text(const std::string& name);
+
 std::vector<std::string> split_char(const std::string& l, char delim);
 
 std::vector<std::string> split_space(const std::string& l);
@@ -101,4 +105,68 @@ auto frequencies(R&& r) {
     return result;
 }
 
+inline std::size_t thread_count() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Calls f(chunk, begin, end) for chunk_count contiguous slices of [0, n), each on its own thread
+// (the first on the caller's). Exceptions are caught per slice and the first one rethrown once
+// every thread has joined.
+template <typename F>
+void parallel_chunks(std::size_t n, std::size_t chunk_count, F f) {
+    chunk_count = std::clamp<std::size_t>(chunk_count, 1, std::max<std::size_t>(n, 1));
+    std::vector<std::exception_ptr> errors(chunk_count);
+    auto run = [&](std::size_t c) {
+        try {
+            f(c, n * c / chunk_count, n * (c + 1) / chunk_count);
+        } catch (...) {
+            errors[c] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (std::size_t c = 1; c < chunk_count; c++) {
+        workers.emplace_back(run, c);
+    }
+    run(0);
+    for (auto& w: workers) {
+        w.join();
+    }
+
+    for (auto& e: errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+// f(i) for every i in [0, n), spread over the hardware threads
+template <typename F>
+void parallel_for(std::size_t n, F f) {
+    parallel_chunks(n, thread_count(), [&f](std::size_t, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            f(i);
+        }
+    });
+}
+
+// op over f(i) for every i in [0, n), folded into init. Every thread reduces its own slice, so
+// op must be associative, but need not have an identity.
+template <typename T, typename Op, typename F>
+T parallel_reduce(std::size_t n, T init, Op op, F f) {
+    std::vector<std::optional<T>> partials(std::min(thread_count(), std::max<std::size_t>(n, 1)));
+    parallel_chunks(n, partials.size(), [&](std::size_t c, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            partials[c] = partials[c] ? op(std::move(*partials[c]), f(i)) : T(f(i));
+        }
+    });
+
+    for (auto& p: partials) {
+        if (p) {
+            init = op(std::move(init), std::move(*p));
+        }
+    }
+    return init;
+}
+
 #endif //AOC2021_UTIL_H